@@ -0,0 +1,51 @@
+/* Message throughput between threads: raw mailbox puts and gets, then
+   numbers sent from one instance to an actor that sums them */
+#include "bench.h"
+
+#define MSGS 2000000
+#define LISP_MSGS 100000
+
+static lmail* box;
+
+static void* consumer(void* arg) {
+  long* sum = arg;
+  char* stop;
+  for (long i = 0; i < MSGS; i++) {
+    lval* x = lmail_get(box, &stop);
+    *sum += x->num;
+    lval_del(x);
+  }
+  return NULL;
+}
+
+int main(void) {
+  box = lmail_new();
+  long sum = 0;
+  double start = now();
+  pthread_t t;
+  if (pthread_create(&t, NULL, consumer, &sum) != 0) { return 1; }
+  for (long i = 0; i < MSGS; i++) { lmail_put(box, lval_num(i)); }
+  pthread_join(t, NULL);
+  double s = now() - start;
+  lmail_unref(box);
+  printf("mailbox  %d msgs  %.3fs  %.1f M msgs/s  (sum %ld)\n",
+    MSGS, s, MSGS / s / 1e6, sum);
+
+  mylisp* m = mylisp_new();
+  char src[256];
+  snprintf(src, sizeof(src),
+    "def {a} (actor-spawn {send parent (reduce (\\ {s x} {+ s (recv self)})"
+    " (range 0 %d))})", LISP_MSGS + 1);
+  run(m, src);
+  snprintf(src, sizeof(src),
+    "def {sent} (collect (map (\\ {x} {send a x}) (range 0 %d)))", LISP_MSGS);
+  start = now();
+  run(m, src);
+  char* out = mylisp_eval_string(m, "recv self");
+  s = now() - start;
+  printf("actor    %d msgs  %.3fs  %.2f M msgs/s  (sum %s)\n",
+    LISP_MSGS, s, LISP_MSGS / s / 1e6, out);
+  free(out);
+  mylisp_free(m);
+  return 0;
+}
@@ -0,0 +1,17 @@
+#include <time.h>
+#include "bench.h"
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+double run(mylisp* m, const char* src) {
+  double start = now();
+  char* out = mylisp_eval_string(m, src);
+  double s = now() - start;
+  if (strncmp(out, "Error", 5) == 0) { fprintf(stderr, "%s\n", out); }
+  free(out);
+  return s;
+}
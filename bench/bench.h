@@ -0,0 +1,14 @@
+/* Helpers shared by the benchmarks */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../mylisp.h"
+
+/* Seconds on a monotonic clock */
+double now(void);
+
+/* Evaluates src in m, reporting an error if it gave one; returns how
+   many seconds it took */
+double run(mylisp* m, const char* src);
@@ -0,0 +1,30 @@
+/* Independent instances, one per thread, each running the same program;
+   with no shared state the total rate should grow with the threads */
+#include "bench.h"
+
+#define CALLS 1000000
+
+static void* worker(void* arg) {
+  (void)arg;
+  mylisp* m = mylisp_new();
+  char src[128];
+  run(m, "def {sq} (\\ {x} {* x x})");
+  snprintf(src, sizeof(src), "reduce + (map sq (range 0 %d))", CALLS);
+  run(m, src);
+  mylisp_free(m);
+  return NULL;
+}
+
+int main(void) {
+  for (int n = 1; n <= 8; n *= 2) {
+    pthread_t ts[8];
+    double start = now();
+    for (int i = 0; i < n; i++) {
+      if (pthread_create(&ts[i], NULL, worker, NULL) != 0) { return 1; }
+    }
+    for (int i = 0; i < n; i++) { pthread_join(ts[i], NULL); }
+    double s = now() - start;
+    printf("instances  %d threads  %.3fs  %.2f M calls/s\n", n, s, (double)CALLS * n / s / 1e6);
+  }
+  return 0;
+}
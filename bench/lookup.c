@@ -0,0 +1,32 @@
+/* Global lookups from several threads evaluating against one shared env:
+   each thread maps a lambda reading two globals over a range */
+#include "bench.h"
+
+#define CALLS 1000000
+
+static void* worker(void* arg) {
+  char src[128];
+  snprintf(src, sizeof(src), "reduce + (map (\\ {x} {+ x g}) (range 0 %d))", CALLS);
+  run(arg, src);
+  return NULL;
+}
+
+int main(void) {
+  mylisp* m = mylisp_new();
+  run(m, "def {g} 1");
+  for (int n = 1; n <= 8; n *= 2) {
+    mylisp* ms[8];
+    pthread_t ts[8];
+    for (int i = 0; i < n; i++) { ms[i] = mylisp_attach(m); }
+    double start = now();
+    for (int i = 0; i < n; i++) {
+      if (pthread_create(&ts[i], NULL, worker, ms[i]) != 0) { return 1; }
+    }
+    for (int i = 0; i < n; i++) { pthread_join(ts[i], NULL); }
+    double s = now() - start;
+    for (int i = 0; i < n; i++) { mylisp_free(ms[i]); }
+    printf("lookup  %d threads  %.3fs  %.2f M calls/s\n", n, s, (double)CALLS * n / s / 1e6);
+  }
+  mylisp_free(m);
+  return 0;
+}
@@ -0,0 +1,33 @@
+/* read-numbers on files of 1e5 to 1e7 integers, the file's digits parsed
+   straight into one array; reduce then sums it without boxing */
+#include "bench.h"
+#include <unistd.h>
+
+int main(void) {
+  char path[] = "/tmp/mylisp-read-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) { return 1; }
+  close(fd);
+
+  mylisp* m = mylisp_new();
+  char src[256];
+  unsigned long x = 88172645463325252UL;
+  for (long n = 100000; n <= 10000000; n *= 10) {
+    FILE* f = fopen(path, "w");
+    for (long i = 0; i < n; i++) {
+      /* xorshift, so every run reads the same numbers */
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      fprintf(f, "%ld\n", (long)(x % 2000001) - 1000000);
+    }
+    fclose(f);
+
+    snprintf(src, sizeof(src), "reduce + (read-numbers \"%s\")", path);
+    double s = run(m, src);
+    printf("read-numbers  %8ld  %.3fs  %.1f M numbers/s\n", n, s, n / s / 1e6);
+  }
+  mylisp_free(m);
+  unlink(path);
+  return 0;
+}
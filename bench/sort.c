@@ -0,0 +1,26 @@
+/* sort on scattered numbers, 1e3 to 1e7 elements, which takes the radix
+   path; sort-by with a comparator, the merge path, up to 1e5 */
+#include "bench.h"
+
+int main(void) {
+  mylisp* m = mylisp_new();
+  char src[256];
+  for (long n = 1000; n <= 10000000; n *= 10) {
+    /* A multiplicative hash of the index, so every run sorts the same
+       numbers, negative ones among them */
+    snprintf(src, sizeof(src),
+      "def {xs} (collect (map (\\ {i} {- (%% (* i 2654435761) 4294967291)"
+      " 2147483645}) (range 0 %ld)))", n);
+    run(m, src);
+
+    double s = run(m, "len (sort xs)");
+    printf("sort     %8ld  %.3fs  %.1f M elems/s\n", n, s, n / s / 1e6);
+    if (n <= 100000) {
+      s = run(m, "len (sort-by < xs)");
+      printf("sort-by  %8ld  %.3fs  %.1f M elems/s\n", n, s, n / s / 1e6);
+    }
+  }
+  run(m, "def {xs} ()");
+  mylisp_free(m);
+  return 0;
+}
@@ -1,6 +1,19 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
 #include <float.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "mpc.h"
 #include "mylisp.h"
 
@@ -11,43 +24,761 @@
     return v_err; \
   }
 
-#ifdef _WIN32
-#include <string.h>
+/**/
+/* Evaluation Context */
+/**/
 
-/* Optional case of no editline package */
-static char buffer[2048];
+/* Context of the evaluation running on this thread. Outside of one it
+   is an empty context, so every member can be tested without a check. */
+static lctx lctx_none;
+static __thread lctx* lcur = &lctx_none;
 
-char* readline(char* prompt) {
-  fputs(prompt, stdout);
-  fgets(buffer, 2048, stdin);
-  char* cpy = malloc(strlen(buffer)+1);
-  strpcy(cpy,buffer);
-  cpy[strlen(cpy)-1] = '\0';
-  return cpy;
+/* Makes c this thread's context; returns the previous one */
+lctx* lctx_enter(lctx* c) {
+  lctx* prev = lcur;
+  lcur = c;
+  return prev;
 }
 
-void add_history(char* unused) {}
+void lctx_leave(lctx* prev) {
+  lcur = prev;
+}
 
-#else
-#include <editline/readline.h>
-#include <editline/history.h>
-#endif
+/**/
+/* Evaluation Limits */
+/**/
+
+static long llimit_clock(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+/* Starts the budget of an evaluation entered at the caller's frame. A
+   cancel already requested is kept, so one sent while the caller was
+   still parsing is not lost. */
+void llimit_start(llimit* l) {
+  /* Roughly where the evaluation's C stack starts */
+  l->stack = __builtin_frame_address(0);
+  llimit_reset();
+}
+
+/* Gives the next top-level form the full budget; a cancel stays */
+void llimit_reset(void) {
+  llimit* l = lcur->limit;
+  if (!l) { return; }
+  l->steps = 0;
+  l->depth = 0;
+  l->bytes = 0;
+  l->start = llimit_clock();
+  l->stop = NULL;
+}
+
+int llimit_cancelled(void) {
+  return lcur->limit && __atomic_load_n(&lcur->limit->cancel, __ATOMIC_RELAXED);
+}
+
+/* Tracks live value bytes allocated (or freed, when negative). Freeing
+   values made before the evaluation earns it no extra budget. */
+void llimit_bytes(long n) {
+  llimit* l = lcur->limit;
+  if (!l) { return; }
+  l->bytes += n;
+  if (l->bytes < 0) { l->bytes = 0; }
+}
+
+/* Counts a step; returns why the evaluation must stop, or NULL. Once
+   tripped it keeps failing so the whole evaluation unwinds. */
+char* llimit_poll(void) {
+  llimit* l = lcur->limit;
+  if (!l) { return NULL; }
+  if (l->stop) { return l->stop; }
+  l->steps++;
+  if (__atomic_load_n(&l->cancel, __ATOMIC_RELAXED)) {
+    l->stop = "Evaluation cancelled.";
+  } else if (l->max_steps && l->steps > l->max_steps) {
+    l->stop = "Evaluation exceeded its step limit.";
+  } else if (l->max_bytes && l->bytes > l->max_bytes) {
+    l->stop = "Evaluation exceeded its memory limit.";
+  } else if (l->max_ms && l->steps % LLIMIT_CLOCK == 0
+      && llimit_clock() - l->start > l->max_ms) {
+    l->stop = "Evaluation exceeded its time limit.";
+  }
+  return l->stop;
+}
+
+/* Enters a function call; nesting is bounded, in calls and in C stack
+   bytes, so runaway recursion fails with an error rather than
+   overflowing the C stack */
+char* llimit_push(void) {
+  llimit* l = lcur->limit;
+  if (!l) { return NULL; }
+  char* stop = llimit_poll();
+  if (stop) { return stop; }
+  char here;
+  if (l->depth >= LLIMIT_DEPTH
+      || (intptr_t)((uintptr_t)l->stack - (uintptr_t)&here) > LLIMIT_STACK) {
+    l->stop = "Evaluation exceeded its depth limit.";
+    return l->stop;
+  }
+  l->depth++;
+  return NULL;
+}
+
+void llimit_pop(void) {
+  if (lcur->limit) { lcur->limit->depth--; }
+}
+
+/**/
+/* Background Reclaimer */
+/**/
+
+static void lval_free(lval* v);
+
+void lreclaim_init(lreclaim* r) {
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->ready, NULL);
+  r->started = 0;
+  r->stop = 0;
+  r->freeing = 0;
+  r->waiting = 0;
+  r->head = 0;
+  r->count = 0;
+  r->stack = NULL;
+  r->depth = 0;
+  r->cap = 0;
+}
+
+/* Frees one element of the tree on top of the stack at a time, at most
+   n of them, or all for n < 0. Lists and maps are emptied from the end
+   and then freed themselves. */
+static void lreclaim_drain(lreclaim* r, long n) {
+  r->freeing = 1;
+  while ((r->count > 0 || r->depth > 0) && n-- != 0) {
+    if (r->depth == 0) {
+      r->stack[r->depth++] = r->queue[r->head];
+      r->head = (r->head + 1) % LRECLAIM_QUEUE;
+      r->count--;
+    }
+    lval* v = r->stack[r->depth - 1];
+    if ((v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) && v->count > 0) {
+      lval* x = v->cell[--v->count];
+      if (x) { lval_del(x); }
+    } else if (v->type == LVAL_MAP && v->map->cap > 0) {
+      lmap_entry* s = &v->map->slots[--v->map->cap];
+      if (s->key) {
+        lval_del(s->key);
+        lval_del(s->val);
+      }
+    } else {
+      r->depth--;
+      lval_free(v);
+    }
+  }
+  r->freeing = 0;
+}
+
+static void* lreclaim_main(void* arg) {
+  lreclaim* r = arg;
+  lctx c = lctx_none;
+  c.reclaim = r;
+  lctx_enter(&c);
+  pthread_mutex_lock(&r->lock);
+  while (!r->stop) {
+    /* An evaluation waiting for the lock goes first; its unlock wakes
+       this thread again if anything is left */
+    if ((r->count == 0 && r->depth == 0)
+        || __atomic_load_n(&r->waiting, __ATOMIC_RELAXED)) {
+      pthread_cond_wait(&r->ready, &r->lock);
+      continue;
+    }
+    lreclaim_drain(r, LRECLAIM_BATCH);
+  }
+  pthread_mutex_unlock(&r->lock);
+  lctx_leave(&lctx_none);
+  return NULL;
+}
+
+/* Takes v, whose count has just reached zero, to be freed later. While
+   draining, every nested list or map is taken so none is freed by
+   recursion; otherwise only big ones are, while the queue has room. */
+static int lreclaim_take(lreclaim* r, lval* v) {
+  int n;
+  switch (v->type) {
+    case LVAL_SEXPR:
+    case LVAL_QEXPR: n = v->count; break;
+    case LVAL_MAP: n = v->map->count; break;
+    default: return 0;
+  }
+  if (r->freeing) {
+    if (n == 0) { return 0; }
+    if (r->depth == r->cap) {
+      r->cap *= 2;
+      r->stack = realloc(r->stack, sizeof(lval*) * r->cap);
+    }
+    r->stack[r->depth++] = v;
+    return 1;
+  }
+  if (n < LRECLAIM_MIN || r->count == LRECLAIM_QUEUE) { return 0; }
+  if (!r->started) {
+    if (!r->stack) {
+      r->cap = 64;
+      r->stack = malloc(sizeof(lval*) * r->cap);
+    }
+    if (pthread_create(&r->thread, NULL, lreclaim_main, r) != 0) { return 0; }
+    r->started = 1;
+  }
+  r->queue[(r->head + r->count) % LRECLAIM_QUEUE] = v;
+  r->count++;
+  return 1;
+}
+
+/* Takes r's lock for an evaluation whose context has r. What the
+   reclaimer did not get to is left to lreclaim_step. */
+void lreclaim_lock(lreclaim* r) {
+  __atomic_add_fetch(&r->waiting, 1, __ATOMIC_RELAXED);
+  pthread_mutex_lock(&r->lock);
+  __atomic_sub_fetch(&r->waiting, 1, __ATOMIC_RELAXED);
+}
+
+void lreclaim_unlock(lreclaim* r) {
+  int work = r->count > 0 || r->depth > 0;
+  pthread_mutex_unlock(&r->lock);
+  if (work) { pthread_cond_signal(&r->ready); }
+}
+
+/* Lets the reclaimer run while this thread does work that touches no
+   values, such as parsing; returns what to pass to lreclaim_resume */
+lreclaim* lreclaim_pause(void) {
+  lreclaim* r = lcur->reclaim;
+  if (!r || (r->count == 0 && r->depth == 0)) { return NULL; }
+  lcur->reclaim = NULL;
+  lreclaim_unlock(r);
+  return r;
+}
+
+/* Called on each allocation while an evaluation holds the lock, so the
+   garbage left from the last evaluation is paid off a few elements at a
+   time as this one allocates, not all at its start */
+static void lreclaim_step(lreclaim* r) {
+  if (!r->freeing && (r->count > 0 || r->depth > 0)) {
+    lreclaim_drain(r, LRECLAIM_STEP);
+  }
+}
+
+void lreclaim_resume(lreclaim* r) {
+  if (!r) { return; }
+  lcur->reclaim = r;
+  lreclaim_lock(r);
+}
+
+/* Frees whatever still waits, then stops the thread */
+void lreclaim_free(lreclaim* r) {
+  lctx c = *lcur;
+  c.reclaim = r;
+  lctx* prev = lctx_enter(&c);
+  lreclaim_lock(r);
+  lreclaim_drain(r, -1);
+  r->stop = 1;
+  lreclaim_unlock(r);
+  lctx_leave(prev);
+  if (r->started) {
+    pthread_cond_signal(&r->ready);
+    pthread_join(r->thread, NULL);
+  }
+  free(r->stack);
+  pthread_cond_destroy(&r->ready);
+  pthread_mutex_destroy(&r->lock);
+}
+
+/**/
+/* Evaluation Trace */
+/**/
+
+void ltrace_init(ltrace* t) {
+  t->on = 0;
+  t->head = 0;
+  t->ring = NULL;
+  t->names = NULL;
+}
+
+void ltrace_free(ltrace* t) {
+  free(t->ring);
+  while (t->names) {
+    ltrace_names* prev = t->names->prev;
+    free(t->names);
+    t->names = prev;
+  }
+}
+
+/* Switches recording on, naming every builtin bound in e's global env so
+   a dump can be decoded without this process */
+void ltrace_start(ltrace* t, lenv* e) {
+  if (!t->ring) { t->ring = malloc(sizeof(ltrace_rec) * LTRACE_SIZE); }
+  while (e->par) { e = e->par; }
+
+  lbuf b;
+  lbuf_init(&b, -1);
+  int n = __atomic_load_n(&e->count, __ATOMIC_ACQUIRE);
+  char** syms = __atomic_load_n(&e->syms, __ATOMIC_ACQUIRE);
+  lval** vals = __atomic_load_n(&e->vals, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < n; i++) {
+    lval* f = __atomic_load_n(&vals[i], __ATOMIC_ACQUIRE);
+    if (f->type != LVAL_FUN || !f->fun) { continue; }
+    uint64_t fn = (uintptr_t)f->fun;
+    uint32_t len = strlen(syms[i]);
+    lbuf_put(&b, (char*)&fn, sizeof(fn));
+    lbuf_put(&b, (char*)&len, sizeof(len));
+    lbuf_put(&b, syms[i], len);
+  }
+
+  /* Restarting usually finds the same builtins, and keeps their table */
+  ltrace_names* old = t->names;
+  if (!old || old->len != b.len || memcmp(old->data, b.data, b.len) != 0) {
+    ltrace_names* x = malloc(sizeof(ltrace_names) + b.len);
+    x->prev = old;
+    x->len = b.len;
+    memcpy(x->data, b.data, b.len);
+    __atomic_store_n(&t->names, x, __ATOMIC_RELEASE);
+  }
+  free(b.data);
+  t->on = 1;
+}
+
+static void ltrace_put(ltrace* t, int kind, lval* f, int n) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  ltrace_rec* r = &t->ring[t->head & (LTRACE_SIZE - 1)];
+  r->ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  r->fn = (uintptr_t)f->fun;
+  r->kind = kind;
+  r->n = n;
+  t->head++;
+}
+
+static int ltrace_write(int fd, const void* p, size_t n) {
+  const char* c = p;
+  while (n) {
+    ssize_t k = write(fd, c, n);
+    if (k <= 0) { return 0; }
+    c += k;
+    n -= k;
+  }
+  return 1;
+}
+
+/* Writes the recorded events to path. Only calls async-signal-safe
+   functions, so it may run from a signal handler. */
+int ltrace_dump(ltrace* t, const char* path) {
+  if (!t->ring) { return 0; }
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) { return 0; }
+
+  ltrace_names* names = __atomic_load_n(&t->names, __ATOMIC_ACQUIRE);
+  size_t names_len = names ? names->len : 0;
+  unsigned long head = t->head;
+  size_t n = head < LTRACE_SIZE ? head : LTRACE_SIZE;
+  size_t start = (head - n) & (LTRACE_SIZE - 1);
+  size_t first = n < LTRACE_SIZE - start ? n : LTRACE_SIZE - start;
+  ltrace_hdr h;
+  memcpy(h.magic, LTRACE_MAGIC, sizeof(h.magic));
+  h.names = names_len;
+  h.count = n;
+  h.total = head;
+
+  int ok = ltrace_write(fd, &h, sizeof(h))
+    && (!names || ltrace_write(fd, names->data, names_len))
+    && ltrace_write(fd, t->ring + start, sizeof(ltrace_rec) * first)
+    && ltrace_write(fd, t->ring, sizeof(ltrace_rec) * (n - first));
+  close(fd);
+  return ok;
+}
+
+/**/
+/* Sampling Profiler */
+/**/
+
+/* The profiling timer is per process, so one profile runs at a time.
+   It counts the CPU time of every thread, so time other threads spend
+   (actors, parallel readers, attached instances) is charged to whatever
+   stack the profiled evaluation is on. */
+static lprof* volatile lprof_active;
+
+void lprof_init(lprof* p) {
+  p->ticks = 0;
+  p->top = NULL;
+  p->path = NULL;
+  p->count = 0;
+  p->cap = 0;
+  p->slots = NULL;
+}
+
+static void lprof_tick(int sig) {
+  lprof* p = lprof_active;
+  if (p) { p->ticks++; }
+}
+
+static unsigned long lhash_bytes(unsigned long h, const void* p, size_t n);
+
+static lprof_entry* lprof_find(lprof* p, unsigned long h, char* stack) {
+  int mask = p->cap - 1;
+  for (int i = h & mask; ; i = (i + 1) & mask) {
+    lprof_entry* s = &p->slots[i];
+    if (!s->stack || (s->hash == h && strcmp(s->stack, stack) == 0)) {
+      return s;
+    }
+  }
+}
+
+/* Charges the pending ticks to the current stack, folded root first */
+static void lprof_sample(lprof* p) {
+  long n = p->ticks;
+  p->ticks = 0;
+
+  lprof_frame* frames[LPROF_DEPTH];
+  int depth = 0;
+  for (lprof_frame* f = p->top; f && depth < LPROF_DEPTH; f = f->up) {
+    frames[depth++] = f;
+  }
+  lbuf b;
+  lbuf_init(&b, -1);
+  if (depth == 0) { lbuf_puts(&b, "[toplevel]"); }
+  for (int i = depth - 1; i >= 0; i--) {
+    lbuf_puts(&b, frames[i]->head ? frames[i]->head->sym : "[lambda]");
+    if (i) { lbuf_putc(&b, ';'); }
+  }
+  lbuf_putc(&b, '\0');
+
+  if ((p->count + 1) * 4 > p->cap * 3) {
+    lprof_entry* old = p->slots;
+    int cap = p->cap;
+    p->cap = cap ? cap * 2 : 64;
+    p->slots = calloc(p->cap, sizeof(lprof_entry));
+    for (int i = 0; i < cap; i++) {
+      if (old[i].stack) { *lprof_find(p, old[i].hash, old[i].stack) = old[i]; }
+    }
+    free(old);
+  }
+  unsigned long h = lhash_bytes(14695981039346656037UL, b.data, b.len);
+  lprof_entry* s = lprof_find(p, h, b.data);
+  if (s->stack) {
+    free(b.data);
+  } else {
+    s->stack = b.data;
+    s->hash = h;
+    p->count++;
+  }
+  s->count += n;
+}
+
+/* Frames are pushed around each call lval_eval_sexpr makes; head is a
+   reference to the call's symbol, or NULL */
+static void lprof_push(lprof* p, lprof_frame* f, lval* head) {
+  if (p->ticks) { lprof_sample(p); }
+  f->head = head;
+  f->up = p->top;
+  p->top = f;
+}
+
+static void lprof_pop(lprof* p, lprof_frame* f) {
+  if (p->ticks) { lprof_sample(p); }
+  p->top = f->up;
+  if (f->head) { lval_del(f->head); }
+}
+
+/* Samples hz times per second of CPU time until lprof_stop */
+int lprof_start(lprof* p, int hz, const char* path) {
+  if (lprof_active || hz <= 0 || hz > 1000000) { return 0; }
+  p->path = malloc(strlen(path) + 1);
+  strcpy(p->path, path);
+  lprof_active = p;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = lprof_tick;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+
+  struct itimerval it;
+  long us = 1000000 / hz;
+  it.it_interval.tv_sec = us / 1000000;
+  it.it_interval.tv_usec = us % 1000000;
+  it.it_value = it.it_interval;
+  if (setitimer(ITIMER_PROF, &it, NULL) != 0) {
+    lprof_active = NULL;
+    free(p->path);
+    p->path = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+/* Stops sampling and writes one "frame;frame;... count" line per stack,
+   the folded format flame graph tools read */
+int lprof_stop(lprof* p) {
+  if (!p->path) { return 1; }
+  struct itimerval it;
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_PROF, &it, NULL);
+  lprof_active = NULL;
+
+  int fd = open(p->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  lbuf b;
+  lbuf_init(&b, fd);
+  for (int i = 0; i < p->cap; i++) {
+    lprof_entry* s = &p->slots[i];
+    if (!s->stack) { continue; }
+    if (fd >= 0 && s->count) {
+      lbuf_puts(&b, s->stack);
+      lbuf_putc(&b, ' ');
+      lbuf_num(&b, s->count);
+      lbuf_putc(&b, '\n');
+    }
+    free(s->stack);
+  }
+  lbuf_flush(&b);
+  free(b.data);
+  if (fd >= 0) { close(fd); }
+
+  free(p->slots);
+  free(p->path);
+  lprof_init(p);
+  return fd >= 0;
+}
+
+/**/
+/* Form Timing */
+/**/
+
+static uint64_t ltime_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Below 2 * LHIST_SUB every value has its own bucket; above, each power
+   of two is split into LHIST_SUB steps of its top bits */
+static int lhist_index(uint64_t ns) {
+  if (ns < 2 * LHIST_SUB) { return ns; }
+  int shift = 63 - __builtin_clzll(ns) - __builtin_ctz(LHIST_SUB);
+  return shift * LHIST_SUB + (ns >> shift);
+}
+
+/* Highest value recorded into bucket i */
+static uint64_t lhist_value(int i) {
+  if (i < 2 * LHIST_SUB) { return i; }
+  int shift = i / LHIST_SUB - 1;
+  uint64_t sub = i % LHIST_SUB + LHIST_SUB;
+  return ((sub + 1) << shift) - 1;
+}
+
+void lhist_add(lhist* h, uint64_t ns) {
+  h->buckets[lhist_index(ns)]++;
+  h->count++;
+  if (ns > h->max) { h->max = ns; }
+}
+
+/* Latency at or below which a fraction q of the recorded ones fall */
+uint64_t lhist_quantile(lhist* h, double q) {
+  if (h->count == 0) { return 0; }
+  uint64_t want = q * h->count;
+  if (want < q * h->count || want < 1) { want++; }
+  uint64_t seen = 0;
+  for (int i = 0; i < LHIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= want) {
+      uint64_t v = lhist_value(i);
+      return v < h->max ? v : h->max;
+    }
+  }
+  return h->max;
+}
+
+void ltime_init(ltime* t) {
+  memset(t, 0, sizeof(ltime));
+}
+
+/* Times every top-level form from now on, keeping the top slowest for a
+   CSV written to csv, if given, when timing stops */
+int ltime_start(ltime* t, int top, const char* csv) {
+  if (t->on || top < 0) { return 0; }
+  t->on = 1;
+  t->top = top;
+  t->slow = malloc(sizeof(ltime_form) * (top + 1));
+  if (csv) {
+    t->csv = malloc(strlen(csv) + 1);
+    strcpy(t->csv, csv);
+  }
+  return 1;
+}
+
+/* Starts timing a form read from where; src is its text */
+static void ltime_begin(const char* where, const char* src, size_t len) {
+  ltime* t = lcur->time;
+  if (!t) { return; }
+  memset(&t->form, 0, sizeof(ltime_form));
+  t->form.where = (char*)where;
+  t->src = src;
+  t->len = len;
+  t->mark = ltime_now();
+}
+
+static void ltime_phase(int phase, uint64_t ns) {
+  ltime* t = lcur->time;
+  if (!t) { return; }
+  lhist_add(&t->phases[phase], ns);
+  t->form.ns[phase] = ns;
+  t->form.total += ns;
+}
+
+/* Ends a phase that ran since the form began or the last phase ended */
+static void ltime_lap(int phase) {
+  ltime* t = lcur->time;
+  if (!t) { return; }
+  uint64_t now = ltime_now();
+  ltime_phase(phase, now - t->mark);
+  t->mark = now;
+}
+
+static void ltime_swap(ltime_form* a, int i, int j) {
+  ltime_form x = a[i];
+  a[i] = a[j];
+  a[j] = x;
+}
+
+/* Keeps the form just timed if it is among the slowest; the heap's root
+   is the fastest of those kept */
+static void ltime_end(void) {
+  ltime* t = lcur->time;
+  if (!t || t->top == 0) { return; }
+  ltime_form* h = t->slow;
+  if (t->count == t->top) {
+    if (t->form.total <= h[0].total) { return; }
+    free(h[0].where);
+    free(h[0].text);
+    h[0] = h[--t->count];
+    for (int i = 0; ; ) {
+      int c = 2 * i + 1;
+      if (c >= t->count) { break; }
+      if (c + 1 < t->count && h[c+1].total < h[c].total) { c++; }
+      if (h[i].total <= h[c].total) { break; }
+      ltime_swap(h, i, c);
+      i = c;
+    }
+  }
+  ltime_form* f = &h[t->count];
+  *f = t->form;
+  f->where = malloc(strlen(t->form.where) + 1);
+  strcpy(f->where, t->form.where);
+  f->text = malloc(t->len + 1);
+  memcpy(f->text, t->src, t->len);
+  f->text[t->len] = '\0';
+  for (int i = t->count++; i > 0 && h[(i-1)/2].total > h[i].total; i = (i-1)/2) {
+    ltime_swap(h, i, (i-1)/2);
+  }
+}
+
+static int ltime_slower(const void* a, const void* b) {
+  const ltime_form* x = a;
+  const ltime_form* y = b;
+  return x->total < y->total ? 1 : x->total > y->total ? -1 : 0;
+}
+
+static void ltime_csv_field(lbuf* b, const char* s) {
+  lbuf_putc(b, '"');
+  for (; *s; s++) {
+    if (*s == '"') { lbuf_putc(b, '"'); }
+    lbuf_putc(b, *s);
+  }
+  lbuf_putc(b, '"');
+}
+
+static void ltime_csv_us(lbuf* b, uint64_t ns) {
+  char tmp[32];
+  snprintf(tmp, sizeof(tmp), "%.3f,", ns / 1000.0);
+  lbuf_puts(b, tmp);
+}
+
+/* Writes p50/p90/p99/max of each phase to stderr and the slowest forms,
+   slowest first, to the CSV */
+int ltime_stop(ltime* t) {
+  if (!t->on) { return 1; }
+  static const char* names[] = { "read", "eval", "print" };
+  fprintf(stderr, "%-6s %10s %12s %12s %12s %12s\n",
+    "phase", "forms", "p50 us", "p90 us", "p99 us", "max us");
+  for (int i = 0; i < LTIME_PHASES; i++) {
+    lhist* h = &t->phases[i];
+    fprintf(stderr, "%-6s %10llu %12.1f %12.1f %12.1f %12.1f\n", names[i],
+      (unsigned long long)h->count, lhist_quantile(h, 0.5) / 1000.0,
+      lhist_quantile(h, 0.9) / 1000.0, lhist_quantile(h, 0.99) / 1000.0,
+      h->max / 1000.0);
+  }
+
+  int ok = 1;
+  qsort(t->slow, t->count, sizeof(ltime_form), ltime_slower);
+  if (t->csv) {
+    int fd = open(t->csv, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ok = fd >= 0;
+    lbuf b;
+    lbuf_init(&b, fd);
+    if (ok) { lbuf_puts(&b, "total_us,read_us,eval_us,print_us,file,form\n"); }
+    for (int i = 0; ok && i < t->count; i++) {
+      ltime_form* f = &t->slow[i];
+      ltime_csv_us(&b, f->total);
+      for (int j = 0; j < LTIME_PHASES; j++) { ltime_csv_us(&b, f->ns[j]); }
+      ltime_csv_field(&b, f->where);
+      lbuf_putc(&b, ',');
+      ltime_csv_field(&b, f->text);
+      lbuf_putc(&b, '\n');
+    }
+    lbuf_flush(&b);
+    free(b.data);
+    if (fd >= 0) { close(fd); }
+  }
+
+  for (int i = 0; i < t->count; i++) {
+    free(t->slow[i].where);
+    free(t->slow[i].text);
+  }
+  free(t->slow);
+  free(t->csv);
+  ltime_init(t);
+  return ok;
+}
 
 /**/
 /* LISP Value constructors and functions */
 /**/
 
+/* Every value is allocated here so its bytes are counted */
+static lval* lval_alloc(void) {
+  if (lcur->reclaim) { lreclaim_step(lcur->reclaim); }
+  llimit_bytes(sizeof(lval));
+  lval* v = malloc(sizeof(lval));
+  v->cons = NULL;
+  return v;
+}
+
+/* Sets a list's length, counting its cell array bytes */
+static void lval_set_count(lval* v, int n) {
+  llimit_bytes((long)(n - v->count) * (long)sizeof(lval*));
+  v->count = n;
+}
+
 /* Constructors */
 lval* lval_num(long n) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_NUM;
+  v->refs = 1;
   v->num = n;
   return v;
 }
 
 lval* lval_err(char* e, ...) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_ERR;
+  v->refs = 1;
 
   va_list va;
   va_start(va, e);
@@ -62,43 +793,163 @@ lval* lval_err(char* e, ...) {
 }
 
 lval* lval_sym(char* s) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_SYM;
+  v->refs = 1;
   v->sym = malloc(strlen(s) + 1);
   strcpy(v->sym, s);
+  v->depth = 0;
+  v->slot = LSLOT_NONE;
   return v;
 }
 
 lval* lval_fun(lbuiltin f) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_FUN;
+  v->refs = 1;
   v->fun = f;
+  v->env = NULL;
+  v->formals = NULL;
+  v->body = NULL;
+  v->memo = NULL;
+  return v;
+}
+
+/* Takes ownership of formals and body; the defining env is captured */
+lval* lval_lambda(lval* formals, lval* body, lenv* env) {
+  lval* v = lval_alloc();
+  v->type = LVAL_FUN;
+  v->refs = 1;
+  v->fun = NULL;
+  v->env = lenv_ref(env);
+  v->formals = formals;
+  v->body = body;
+  v->memo = NULL;
   return v;
 }
 
 lval* lval_sexpr(void) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_SEXPR;
+  v->refs = 1;
   v->count = 0;
   v->cell = NULL;
+  v->jit = NULL;
+  v->hot = 0;
   return v;
 }
 
 lval* lval_qexpr(void) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_QEXPR;
+  v->refs = 1;
   v->count = 0;
   v->cell = NULL;
+  v->jit = NULL;
+  v->hot = 0;
+  return v;
+}
+
+/* Copies len bytes; short strings are kept inline */
+lval* lval_str(const char* s, size_t len) {
+  lval* v = lval_alloc();
+  v->type = LVAL_STR;
+  v->refs = 1;
+  v->len = len;
+  if (len <= LSTR_INLINE) {
+    v->strbuf = NULL;
+    v->str = v->small;
+  } else {
+    llimit_bytes(sizeof(lstr) + len + 1);
+    v->strbuf = malloc(sizeof(lstr) + len + 1);
+    v->strbuf->refs = 1;
+    v->strbuf->len = len;
+    v->strbuf->data[len] = '\0';
+    v->str = v->strbuf->data;
+  }
+  if (s) { memcpy(v->str, s, len); }
+  return v;
+}
+
+/* Substring of v; long strings share v's storage without copying */
+lval* lval_str_slice(lval* v, size_t start, size_t len) {
+  if (len <= LSTR_INLINE || !v->strbuf) { return lval_str(v->str + start, len); }
+  lval* x = lval_alloc();
+  x->type = LVAL_STR;
+  x->refs = 1;
+  x->strbuf = v->strbuf;
+  if (x->strbuf->refs != LREFS_SHARED) { x->strbuf->refs++; }
+  x->str = v->str + start;
+  x->len = len;
+  return x;
+}
+
+lval* lval_map(void) {
+  lval* v = lval_alloc();
+  v->type = LVAL_MAP;
+  v->refs = 1;
+  v->map = malloc(sizeof(lmap));
+  v->map->count = 0;
+  v->map->cap = 8;
+  v->map->slots = calloc(v->map->cap, sizeof(lmap_entry));
+  return v;
+}
+
+lval* lval_chan(int cap) {
+  lval* v = lval_alloc();
+  v->type = LVAL_CHAN;
+  v->refs = 1;
+  v->chan = malloc(sizeof(lchan));
+  v->chan->refs = 1;
+  v->chan->cap = cap;
+  v->chan->count = 0;
+  v->chan->head = 0;
+  v->chan->size = 0;
+  v->chan->items = NULL;
+  v->chan->senders.head = v->chan->senders.tail = NULL;
+  v->chan->receivers.head = v->chan->receivers.tail = NULL;
+  v->chan->mail = NULL;
+  return v;
+}
+
+/* Takes ownership of the upstream sequence src, if any */
+lval* lval_seq(int kind, lval* src) {
+  lval* v = lval_alloc();
+  v->type = LVAL_SEQ;
+  v->refs = 1;
+  v->seq = malloc(sizeof(lseq));
+  v->seq->kind = kind;
+  v->seq->cur = 0;
+  v->seq->end = 0;
+  v->seq->step = 1;
+  v->seq->n = 0;
+  v->seq->src = src;
+  v->seq->fn = NULL;
+  v->seq->bin = NULL;
+  v->seq->nums = NULL;
   return v;
 }
 
 /* Functions */
 lval* lval_copy(lval* v) {
-  lval* x = malloc(sizeof(lval));
+  lval* x = lval_alloc();
   x->type = v->type;
+  x->refs = 1;
 
   switch (v->type) {
-    case LVAL_FUN: x->fun = v->fun; break;
+    case LVAL_FUN:
+      x->fun = v->fun;
+      x->env = NULL;
+      x->formals = NULL;
+      x->body = NULL;
+      x->memo = v->memo;
+      if (v->memo) { v->memo->refs++; }
+      if (!v->fun && !v->memo) {
+        x->env = lenv_ref(v->env);
+        x->formals = lval_copy(v->formals);
+        x->body = lval_copy(v->body);
+      }
+      break;
     case LVAL_NUM: x->num = v->num; break;
 
     case LVAL_ERR:
@@ -107,513 +958,5772 @@ lval* lval_copy(lval* v) {
 
     case LVAL_SYM:
       x->sym = malloc(strlen(v->sym) + 1);
-      strcpy(x->sym, v->sym); break;
+      strcpy(x->sym, v->sym);
+      x->depth = v->depth;
+      x->slot = v->slot;
+      break;
+
+    case LVAL_STR:
+      x->len = v->len;
+      x->strbuf = v->strbuf;
+      if (v->strbuf) {
+        if (v->strbuf->refs != LREFS_SHARED) { v->strbuf->refs++; }
+        x->str = v->str;
+      } else {
+        x->str = x->small;
+        memcpy(x->small, v->small, v->len);
+      }
+      break;
 
     case LVAL_SEXPR:
     case LVAL_QEXPR:
-      x->count = v->count;
+      x->jit = NULL;
+      x->hot = 0;
+      x->count = 0;
+      lval_set_count(x, v->count);
       x->cell = malloc(sizeof(lval*) * x->count);
       for (int i = 0; i < x->count; i++) {
         x->cell[i] = lval_copy(v->cell[i]);
       }
     break;
+
+    /* Channels are shared, never copied */
+    case LVAL_CHAN:
+      x->chan = v->chan;
+      x->chan->refs++;
+      break;
+
+    case LVAL_MAP:
+      x->map = malloc(sizeof(lmap));
+      *x->map = *v->map;
+      x->map->slots = calloc(v->map->cap, sizeof(lmap_entry));
+      for (int i = 0; i < v->map->cap; i++) {
+        lmap_entry* s = &v->map->slots[i];
+        if (!s->key) { continue; }
+        x->map->slots[i].hash = s->hash;
+        x->map->slots[i].key = lval_copy(s->key);
+        x->map->slots[i].val = lval_copy(s->val);
+      }
+      break;
+
+    /* Sequences carry iteration state, so a copy gets its own chain */
+    case LVAL_SEQ:
+      x->seq = malloc(sizeof(lseq));
+      *x->seq = *v->seq;
+      if (v->seq->src) { x->seq->src = lval_copy(v->seq->src); }
+      if (v->seq->fn) { x->seq->fn = lval_ref(v->seq->fn); }
+      if (v->seq->bin) { v->seq->bin->refs++; }
+      if (v->seq->nums) { v->seq->nums->refs++; }
+      break;
+  }
+  return x;
+}
+
+/* Values are reference counted; a shared value must not be mutated, so
+   anything about to change one takes it through lval_own first. Values
+   in a shared env are not counted at all. */
+lval* lval_ref(lval* v) {
+  if (v->refs != LREFS_SHARED) { v->refs++; }
+  return v;
+}
+
+/* Returns a uniquely owned version of v. A shared list or map is cloned
+   one level deep, its children become shared with the original. */
+lval* lval_own(lval* v) {
+  if (v->refs == 1) { return v; }
+  if (v->type == LVAL_MAP) {
+    lval* x = lval_map();
+    free(x->map->slots);
+    *x->map = *v->map;
+    x->map->slots = malloc(sizeof(lmap_entry) * v->map->cap);
+    memcpy(x->map->slots, v->map->slots, sizeof(lmap_entry) * v->map->cap);
+    for (int i = 0; i < v->map->cap; i++) {
+      if (x->map->slots[i].key) {
+        lval_ref(x->map->slots[i].key);
+        lval_ref(x->map->slots[i].val);
+      }
+    }
+    lval_del(v);
+    return x;
+  }
+  if (v->type != LVAL_SEXPR && v->type != LVAL_QEXPR) {
+    lval* x = lval_copy(v);
+    lval_del(v);
+    return x;
   }
+  lval* x = lval_alloc();
+  x->type = v->type;
+  x->refs = 1;
+  x->jit = NULL;
+  x->hot = 0;
+  x->count = 0;
+  lval_set_count(x, v->count);
+  x->cell = malloc(sizeof(lval*) * v->count);
+  for (int i = 0; i < v->count; i++) {
+    x->cell[i] = lval_ref(v->cell[i]);
+  }
+  lval_del(v);
   return x;
 }
 
+/* True when no node of v is shared */
+int lval_unique(lval* v) {
+  if (v->refs != 1) { return 0; }
+  if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {
+    for (int i = 0; i < v->count; i++) {
+      if (!lval_unique(v->cell[i])) { return 0; }
+    }
+  }
+  return 1;
+}
+
+static void lmemo_del(lmemo* m);
+static void lcons_remove(lval* v);
+
 void lval_del(lval* v) {
+  if (v->refs == LREFS_SHARED) { return; }
+  if (--v->refs > 0) {
+    /* Only the hash-consing table still holds it */
+    if (v->refs == 1 && v->cons) { lcons_remove(v); }
+    return;
+  }
+  if (lcur->reclaim && lreclaim_take(lcur->reclaim, v)) { return; }
+  lval_free(v);
+}
+
+static void lval_free(lval* v) {
   switch (v->type) {
-    case LVAL_FUN: break;
+    case LVAL_FUN:
+      if (v->memo) {
+        lmemo_del(v->memo);
+      } else if (!v->fun) {
+        lenv_unref(v->env);
+        lval_del(v->formals);
+        lval_del(v->body);
+      }
+      break;
     case LVAL_NUM: break;
 
     case LVAL_ERR: free(v->err); break;
     case LVAL_SYM: free(v->sym); break;
+    case LVAL_STR:
+      if (v->strbuf && v->strbuf->refs != LREFS_SHARED
+          && --v->strbuf->refs == 0) {
+        llimit_bytes(-(long)(sizeof(lstr) + v->strbuf->len + 1));
+        free(v->strbuf);
+      }
+      break;
 
     case LVAL_QEXPR:
     case LVAL_SEXPR:
       for (int i = 0; i < v->count; i++) {
-        lval_del(v->cell[i]);
+        if (v->cell[i]) { lval_del(v->cell[i]); }
       }
+      llimit_bytes(-(long)(v->count * sizeof(lval*)));
       free(v->cell);
+      if (v->jit) { ljit_free(v->jit); }
       break;
-  }
-  free(v);
-}
 
-char* ltype_name(int t) {
+    case LVAL_MAP:
+      for (int i = 0; i < v->map->cap; i++) {
+        if (v->map->slots[i].key) {
+          lval_del(v->map->slots[i].key);
+          lval_del(v->map->slots[i].val);
+        }
+      }
+      free(v->map->slots);
+      free(v->map);
+      break;
+
+    case LVAL_SEQ:
+      if (v->seq->src) { lval_del(v->seq->src); }
+      if (v->seq->fn) { lval_del(v->seq->fn); }
+      if (v->seq->bin && --v->seq->bin->refs == 0) {
+        lreader_close(&v->seq->bin->r);
+        free(v->seq->bin);
+      }
+      if (v->seq->nums && --v->seq->nums->refs == 0) {
+        llimit_bytes(-(long)(sizeof(long) * v->seq->nums->count));
+        free(v->seq->nums->data);
+        free(v->seq->nums);
+      }
+      free(v->seq);
+      break;
+
+    case LVAL_CHAN:
+      if (--v->chan->refs > 0) { break; }
+      if (v->chan->mail) { lmail_unref(v->chan->mail); }
+      for (int i = 0; i < v->chan->count; i++) {
+        lval_del(v->chan->items[(v->chan->head + i) % v->chan->size]);
+      }
+      free(v->chan->items);
+      free(v->chan);
+      break;
+  }
+  llimit_bytes(-(long)sizeof(lval));
+  free(v);
+}
+
+char* ltype_name(int t) {
   switch(t) {
     case LVAL_FUN: return "Function";
     case LVAL_NUM: return "Number";
     case LVAL_ERR: return "Error";
     case LVAL_SYM: return "Symbol";
+    case LVAL_STR: return "String";
+    case LVAL_MAP: return "Map";
     case LVAL_SEXPR: return "S-Expression";
     case LVAL_QEXPR: return "Q-Expression";
+    case LVAL_SEQ: return "Sequence";
+    case LVAL_CHAN: return "Channel";
     default: return "Unknown";
   }
 }
 
 /* Stack manipulation functions */
 lval* lval_add(lval* v, lval* k) {
-  v->count++;
+  lval_set_count(v, v->count+1);
   v->cell = realloc(v->cell, sizeof(lval*) * v->count);
   v->cell[v->count-1] = k;
   return v;
 }
 
+/* The cell array is not shrunk; lval_add reallocates it when it grows */
 lval* lval_pop(lval* v, int i) {
   lval* x = v->cell[i];
   memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
-  v->count--;
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+  lval_set_count(v, v->count-1);
+  return x;
+}
+
+/* Moves cell i out and leaves a NULL hole, which only lval_del accepts.
+   A shared list keeps its cell and hands out a reference instead. */
+lval* lval_steal(lval* v, int i) {
+  if (v->refs > 1) { return lval_ref(v->cell[i]); }
+  lval* x = v->cell[i];
+  v->cell[i] = NULL;
   return x;
 }
 
 lval* lval_take(lval* v, int i) {
-  lval* x = lval_pop(v, i);
+  lval* x = lval_steal(v, i);
   lval_del(v);
   return x;
 }
 
+/* Appends k's cells to v with a single reallocation */
 lval* lval_join(lval* v, lval* k) {
-  while (k->count) {
-    v = lval_add(v, lval_pop(k, 0));
+  v = lval_own(v);
+  v->cell = realloc(v->cell, sizeof(lval*) * (v->count + k->count));
+  for (int i = 0; i < k->count; i++) {
+    v->cell[v->count + i] = lval_steal(k, i);
   }
+  lval_set_count(v, v->count + k->count);
   lval_del(k);
   return v;
 }
 
-/**/
-/* LISP Environment Constructors & Functions */
-/**/
+static lval* lmemo_call(lenv* e, lmemo* m, lval* a);
+static lval* lval_apply(lenv* e, lval* f, lval* a);
 
-lenv* lenv_new(void) {
-  lenv* e = malloc(sizeof(lenv));
-  e->count = 0;
-  e->syms = NULL;
-  e->vals = NULL;
-  return e;
+/* Every application counts against the evaluation's budget */
+lval* lval_call(lenv* e, lval* f, lval* a) {
+  char* stop = llimit_push();
+  if (stop) {
+    lval_del(a);
+    return lval_err("%s", stop);
+  }
+  lval* r = lval_apply(e, f, a);
+  llimit_pop();
+  return r;
 }
 
-lval* lenv_get(lenv* e, lval* v) {
-  for (int i = 0; i < e->count; i++) {
-    if (strcmp(e->syms[i], v->sym) == 0) {
-      return lval_copy(e->vals[i]);
-    }
+/* Function application; a lambda gets a fresh frame whose dense vals
+   array is the argument cell array itself */
+static lval* lval_apply(lenv* e, lval* f, lval* a) {
+  if (f->fun) { return f->fun(e, a); }
+  if (f->memo) { return lmemo_call(e, f->memo, a); }
+
+  LASSERT(a, a->count == f->formals->count,
+    "Function passed incorrect number of arguments.\nGot %i, Expected %i.",
+    a->count, f->formals->count);
+
+  lenv* frame = lenv_frame(f->env, 0);
+  frame->count = a->count;
+  frame->vals = a->cell;
+  frame->formals = lval_ref(f->formals);
+  frame->syms = malloc(sizeof(char*) * a->count);
+  for (int i = 0; i < a->count; i++) {
+    frame->syms[i] = f->formals->cell[i]->sym;
   }
-  return lval_err("Unbound symbol '%s'", v->sym);
-}
+  a->cell = NULL;
+  lval_set_count(a, 0);
+  lval_del(a);
 
-void lenv_put(lenv* e, lval* k, lval* v) {
-  for (int i = 0; i < e->count; i++) {
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      lval_del(e->vals[i]);
-      e->vals[i] = lval_copy(v);
-      return;
-    }
+#ifdef LJIT
+  long n;
+  lval* b = f->body;
+  if (b->refs != LREFS_SHARED
+      && (b->jit || (b->hot < LJIT_HOT && ++b->hot == LJIT_HOT))
+      && ljit_run(frame, b, &n)) {
+    lenv_del(frame);
+    return lval_num(n);
   }
-  e->count++;
-  e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-  e->syms = realloc(e->syms, sizeof(char*) * e->count);
+#endif
 
-  e->vals[e->count-1] = lval_copy(v);
-  e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-  strcpy(e->syms[e->count-1], k->sym);
+  lval* body = lval_own(lval_ref(f->body));
+  body->type = LVAL_SEXPR;
+  lval* result = lval_eval(frame, body);
+  lenv_del(frame);
+  return result;
 }
 
-void lenv_del(lenv* e) {
-  for (int i = 0; i < e->count; i++) {
-    free(e->syms[i]);
-    lval_del(e->vals[i]);
+/* Lexical scope chain seen by the resolver, innermost first */
+typedef struct lscope {
+  lval* formals;
+  lenv* frame;
+  struct lscope* up;
+} lscope;
+
+static int lscope_find(lscope* s, char* sym) {
+  if (s->formals) {
+    for (int i = 0; i < s->formals->count; i++) {
+      if (strcmp(s->formals->cell[i]->sym, sym) == 0) { return i; }
+    }
+  } else {
+    for (int i = 0; i < s->frame->count; i++) {
+      if (strcmp(s->frame->syms[i], sym) == 0) { return i; }
+    }
   }
-  free(e->syms);
-  free(e->vals);
-  free(e);
+  return LSLOT_NONE;
 }
 
-void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
-  lval* k = lval_sym(name);
-  lval* v = lval_fun(func);
-  lenv_put(e, k, v);
-  lval_del(k);
-  lval_del(v);
+static void lval_resolve_scope(lval* v, lscope* s) {
+  switch (v->type) {
+    case LVAL_SYM:
+      v->depth = 0;
+      v->slot = LSLOT_GLOBAL;
+      for (lscope* c = s; c; c = c->up, v->depth++) {
+        int i = lscope_find(c, v->sym);
+        if (i >= 0) { v->slot = i; return; }
+      }
+      v->depth = 0;
+      break;
+
+    /* Only evaluated positions are rewritten; quoted data keeps plain names */
+    case LVAL_SEXPR:
+      for (int i = 0; i < v->count; i++) {
+        lval_resolve_scope(v->cell[i], s);
+      }
+      break;
+  }
 }
 
-/* Default built-in environment functions */
-void lenv_add_builtins(lenv* e) {
-  lenv_add_builtin(e, "def", builtin_def);
+/* Rewrites every symbol in a lambda body to a (depth, slot) pair against
+   the formals and the chain of frames enclosing e. Frames never grow after
+   creation, so the pairs stay valid for every call of the lambda. Symbols
+   bound nowhere locally are marked global and skip the frame walk. */
+void lval_resolve(lval* v, lval* formals, lenv* e) {
+  int n = 1;
+  for (lenv* f = e; f->par; f = f->par) { n++; }
 
-  lenv_add_builtin(e, "list", builtin_list);
-  lenv_add_builtin(e, "len", builtin_len);
-  lenv_add_builtin(e, "head", builtin_head);
-  lenv_add_builtin(e, "init", builtin_init);
-  lenv_add_builtin(e, "tail", builtin_tail);
-  lenv_add_builtin(e, "eval", builtin_eval);
-  lenv_add_builtin(e, "join", builtin_join);
+  lscope* scopes = malloc(sizeof(lscope) * n);
+  scopes[0].formals = formals;
+  scopes[0].frame = NULL;
+  lenv* f = e;
+  for (int i = 1; i < n; i++, f = f->par) {
+    scopes[i].formals = NULL;
+    scopes[i].frame = f;
+  }
+  for (int i = 0; i < n; i++) {
+    scopes[i].up = i+1 < n ? &scopes[i+1] : NULL;
+  }
 
-  lenv_add_builtin(e, "+", builtin_add);
-  lenv_add_builtin(e, "-", builtin_sub);
-  lenv_add_builtin(e, "*", builtin_mul);
-  lenv_add_builtin(e, "/", builtin_div);
-  lenv_add_builtin(e, "min", builtin_min);
-  lenv_add_builtin(e, "max", builtin_max);
-  lenv_add_builtin(e, "%", builtin_mod);
-  lenv_add_builtin(e, "^", builtin_exp);
+  for (int i = 0; i < v->count; i++) {
+    lval_resolve_scope(v->cell[i], &scopes[0]);
+  }
+  free(scopes);
 }
 
-
 /**/
-/* LISP Read & Evaluation Functions */
+/* Structural Hashing & Memoization */
 /**/
 
-/* Read functions */
-lval* lval_read(mpc_ast_t* t) {
-  if (strstr(t->tag, "number")) { return lval_read_num(t); }
-  if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
+static unsigned long lhash_bytes(unsigned long h, const void* p, size_t n) {
+  const unsigned char* b = p;
+  for (size_t i = 0; i < n; i++) {
+    h ^= b[i];
+    h *= 1099511628211UL;
+  }
+  return h;
+}
 
-  lval* x = NULL;
-  if (strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
-  if (strstr(t->tag, "sexpr")) { x = lval_sexpr(); }
-  if (strstr(t->tag, "qexpr")) { x = lval_qexpr(); }
+static unsigned long lval_hash_from(unsigned long h, lval* v) {
+  h = lhash_bytes(h, &v->type, sizeof(v->type));
+  switch (v->type) {
+    case LVAL_NUM: h = lhash_bytes(h, &v->num, sizeof(v->num)); break;
+    case LVAL_ERR: h = lhash_bytes(h, v->err, strlen(v->err)); break;
+    case LVAL_SYM: h = lhash_bytes(h, v->sym, strlen(v->sym)); break;
+    case LVAL_STR: h = lhash_bytes(h, v->str, v->len); break;
+    case LVAL_FUN:
+    case LVAL_SEQ: h = lhash_bytes(h, &v, sizeof(v)); break;
+    case LVAL_CHAN:
+      /* Handles on one mailbox are equal */
+      if (v->chan->mail) {
+        h = lhash_bytes(h, &v->chan->mail, sizeof(v->chan->mail));
+      } else {
+        h = lhash_bytes(h, &v->chan, sizeof(v->chan));
+      }
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      h = lhash_bytes(h, &v->count, sizeof(v->count));
+      for (int i = 0; i < v->count; i++) {
+        unsigned long c = lval_hash(v->cell[i]);
+        h = lhash_bytes(h, &c, sizeof(c));
+      }
+      break;
 
-  for (int i = 0; i < t->children_num; i++) {
-    if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
-    if (strcmp(t->children[i]->tag, "regex") == 0) { continue; }
-    x = lval_add(x, lval_read(t->children[i]));
+    /* Entries are combined order independently */
+    case LVAL_MAP: {
+      unsigned long x = 0;
+      for (int i = 0; i < v->map->cap; i++) {
+        lmap_entry* s = &v->map->slots[i];
+        if (s->key) { x += lval_hash_from(s->hash, s->val); }
+      }
+      h = lhash_bytes(h, &x, sizeof(x));
+      break;
+    }
   }
-  return x;
+  return h;
 }
 
-lval* lval_read_num(mpc_ast_t* t) {
-  errno = 0;
-  int x = strtol(t->contents, NULL, 10);
-  return errno != ERANGE ?
-    lval_num(x) : lval_err("Invalid Number.");
+/* Interned nodes carry their hash, so a list hashes in time linear in its
+   own length once its children are interned */
+unsigned long lval_hash(lval* v) {
+  if (v->cons) { return v->hash; }
+  return lval_hash_from(14695981039346656037UL, v);
 }
 
-/* Evaluation function */
-lval* lval_eval(lenv* e, lval* v) {
-  if (v->type == LVAL_SYM) {
-    lval* x = lenv_get(e, v);
-    lval_del(v);
-    return x;
+/* Structural equality; functions compare by identity */
+int lval_eq(lval* x, lval* y) {
+  if (x == y) { return 1; }
+  /* Canonical nodes of one table are equal only when identical */
+  if (x->cons && y->cons && (x->cons == y->cons || x->hash != y->hash)) {
+    return 0;
   }
-  if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
-  return v;
+  if (x->type != y->type) { return 0; }
+  switch (x->type) {
+    case LVAL_NUM: return x->num == y->num;
+    case LVAL_ERR: return strcmp(x->err, y->err) == 0;
+    case LVAL_SYM: return strcmp(x->sym, y->sym) == 0;
+    case LVAL_STR: return x->len == y->len && memcmp(x->str, y->str, x->len) == 0;
+    case LVAL_FUN: return 0;
+    case LVAL_SEQ: return 0;
+    case LVAL_CHAN:
+      return x->chan == y->chan
+        || (x->chan->mail && x->chan->mail == y->chan->mail);
+    case LVAL_MAP:
+      if (x->map->count != y->map->count) { return 0; }
+      for (int i = 0; i < x->map->cap; i++) {
+        lmap_entry* s = &x->map->slots[i];
+        if (!s->key) { continue; }
+        lval* o = lmap_get(y, s->key);
+        if (!o || !lval_eq(s->val, o)) { return 0; }
+      }
+      return 1;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (x->count != y->count) { return 0; }
+      for (int i = 0; i < x->count; i++) {
+        if (!lval_eq(x->cell[i], y->cell[i])) { return 0; }
+      }
+      return 1;
+  }
+  return 0;
 }
 
-/* S-Expression evaluation function */
-lval* lval_eval_sexpr(lenv* e, lval* v) {
-  for (int i = 0; i < v->count; i++) {
-    v->cell[i] = lval_eval(e, v->cell[i]);
+/* Total order used by sort: numbers, symbols and strings by value, lists
+   element by element, values of different types by type */
+int lval_cmp(lval* x, lval* y) {
+  if (x->type != y->type) { return x->type < y->type ? -1 : 1; }
+  switch (x->type) {
+    case LVAL_NUM: return (x->num > y->num) - (x->num < y->num);
+    case LVAL_ERR: return strcmp(x->err, y->err);
+    case LVAL_SYM: return strcmp(x->sym, y->sym);
+    case LVAL_STR: {
+      int c = memcmp(x->str, y->str, x->len < y->len ? x->len : y->len);
+      return c ? c : (x->len > y->len) - (x->len < y->len);
+    }
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      for (int i = 0; i < x->count && i < y->count; i++) {
+        int c = lval_cmp(x->cell[i], y->cell[i]);
+        if (c) { return c; }
+      }
+      return (x->count > y->count) - (x->count < y->count);
   }
+  return 0;
+}
 
-  for (int i = 0; i < v->count; i++) {
-    if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+/* Approximate heap footprint of a value */
+size_t lval_bytes(lval* v) {
+  size_t n = sizeof(lval);
+  switch (v->type) {
+    case LVAL_ERR: n += strlen(v->err) + 1; break;
+    case LVAL_SYM: n += strlen(v->sym) + 1; break;
+    case LVAL_STR: if (v->strbuf) { n += sizeof(lstr) + v->strbuf->len + 1; } break;
+    case LVAL_SEQ: n += sizeof(lseq); break;
+    case LVAL_CHAN: n += sizeof(lchan); break;
+    case LVAL_MAP:
+      n += sizeof(lmap) + sizeof(lmap_entry) * v->map->cap;
+      for (int i = 0; i < v->map->cap; i++) {
+        if (v->map->slots[i].key) {
+          n += lval_bytes(v->map->slots[i].key) + lval_bytes(v->map->slots[i].val);
+        }
+      }
+      break;
+    case LVAL_FUN:
+      if (!v->fun && !v->memo) {
+        n += lval_bytes(v->formals) + lval_bytes(v->body);
+      }
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      n += sizeof(lval*) * v->count;
+      for (int i = 0; i < v->count; i++) {
+        n += lval_bytes(v->cell[i]);
+      }
+      break;
   }
+  return n;
+}
 
-  if (v->count == 0) { return v; }
-  if (v->count == 1) { return lval_take(v, 0); }
+/* Wraps f with a result cache bounded by entry count and bytes */
+lval* lval_memo(lval* f, int max_entries, size_t max_bytes) {
+  lmemo* m = malloc(sizeof(lmemo));
+  m->refs = 1;
+  m->fn = f;
+  m->nbuckets = 16;
+  while (m->nbuckets < max_entries && m->nbuckets < 65536) { m->nbuckets *= 2; }
+  m->buckets = calloc(m->nbuckets, sizeof(lmemo_entry*));
+  m->head = NULL;
+  m->tail = NULL;
+  m->count = 0;
+  m->max_entries = max_entries;
+  m->bytes = 0;
+  m->max_bytes = max_bytes;
+  m->hits = 0;
+  m->misses = 0;
 
-  lval* f = lval_pop(v, 0);
-  if (f->type != LVAL_FUN) {
-    lval_del(f);
-    lval_del(v);
-    return lval_err("Invalid Symbol.");
-  }
+  lval* v = lval_fun(NULL);
+  v->memo = m;
+  return v;
+}
 
-  lval* result = f->fun(e, v);
-  lval_del(f);
+static void lmemo_unlink(lmemo* m, lmemo_entry* x) {
+  if (x->prev) { x->prev->next = x->next; } else { m->head = x->next; }
+  if (x->next) { x->next->prev = x->prev; } else { m->tail = x->prev; }
+}
 
-  return result;
+static void lmemo_push(lmemo* m, lmemo_entry* x) {
+  x->prev = NULL;
+  x->next = m->head;
+  if (m->head) { m->head->prev = x; } else { m->tail = x; }
+  m->head = x;
 }
 
-/**/
-/* Built-in Functions */
-/**/
+/* Drops the least recently used entry */
+static void lmemo_evict(lmemo* m) {
+  lmemo_entry* x = m->tail;
+  lmemo_entry** p = &m->buckets[x->hash & (m->nbuckets-1)];
+  while (*p != x) { p = &(*p)->chain; }
+  *p = x->chain;
+  lmemo_unlink(m, x);
+  m->count--;
+  m->bytes -= x->bytes;
+  lval_del(x->args);
+  lval_del(x->result);
+  free(x);
+}
 
-/* Built-in function lookup */
-lval* builtin(lenv* e, lval* v, char* func) {
-  if (strcmp("list", func) == 0) { return builtin_list(e, v); }
-  if (strcmp("head", func) == 0) { return builtin_head(e, v); }
-  if (strcmp("tail", func) == 0) { return builtin_tail(e, v); }
-  if (strcmp("join", func) == 0) { return builtin_join(e, v); }
-  if (strcmp("eval", func) == 0) { return builtin_eval(e, v); }
-  if (strcmp("init", func) == 0) { return builtin_init(e, v); }
-  if (strcmp("len", func) == 0) { return builtin_len(e, v); }
-  if (strstr("+-/*%^minmax", func)) { return builtin_op(e, v, func); }
+static void lmemo_del(lmemo* m) {
+  if (--m->refs > 0) { return; }
+  while (m->tail) { lmemo_evict(m); }
+  lval_del(m->fn);
+  free(m->buckets);
+  free(m);
+}
 
-  lval_del(v);
-  return lval_err("Unknown Function.");
+/* Copy of v kept as part of a key. Functions compare by identity, so
+   they are referenced rather than copied; the reference also keeps the
+   address from being reused. A function in a shared env is not counted
+   and can only be copied, so it never matches. */
+static lval* lmemo_key(lval* v) {
+  switch (v->type) {
+    case LVAL_FUN:
+      if (v->refs != LREFS_SHARED) { return lval_ref(v); }
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR: {
+      lval* x = v->type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+      for (int i = 0; i < v->count; i++) { lval_add(x, lmemo_key(v->cell[i])); }
+      return x;
+    }
+    case LVAL_MAP: {
+      lval* x = lval_map();
+      for (int i = 0; i < v->map->cap; i++) {
+        lmap_entry* s = &v->map->slots[i];
+        if (s->key) { lmap_put(x, lval_copy(s->key), lmemo_key(s->val)); }
+      }
+      return x;
+    }
+  }
+  return lval_copy(v);
 }
 
-/* Built-in define function */
-lval* builtin_def(lenv* e, lval* v) {
-  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
-    "Function 'def' passed invalid type.\nGot %s, Expected %s.",
-    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+/* Hits hand out a shared reference to the cached result; errors are
+   never cached */
+static lval* lmemo_call(lenv* e, lmemo* m, lval* a) {
+  unsigned long h = lval_hash(a);
+  for (lmemo_entry* x = m->buckets[h & (m->nbuckets-1)]; x; x = x->chain) {
+    if (x->hash == h && lval_eq(x->args, a)) {
+      m->hits++;
+      lmemo_unlink(m, x);
+      lmemo_push(m, x);
+      lval_del(a);
+      return lval_ref(x->result);
+    }
+  }
 
-  lval* syms = v->cell[0];
+  m->misses++;
+  lval* args = lmemo_key(a);
+  lval* result = lval_call(e, m->fn, a);
 
-  for (int i = 0; i < syms->count; i++) {
-    LASSERT(v, syms->cell[i]->type == LVAL_SYM,
-      "Function 'def' passed invalid symbol '%s'",
-      syms->cell[i]->sym);
+  size_t bytes = lval_bytes(args) + lval_bytes(result);
+  if (result->type == LVAL_ERR || m->max_entries <= 0 || bytes > m->max_bytes) {
+    lval_del(args);
+    return result;
   }
-  LASSERT(v, syms->count == v->count-1,
-    "Function 'def' passed invalid number of arguments.\nGot %i, Expected %i.",
-    syms->count, v->count-1);
 
-  for (int i = 0; i < syms->count; i++) {
-    lenv_put(e, syms->cell[i], v->cell[i+1]);
-  }
+  lmemo_entry* x = malloc(sizeof(lmemo_entry));
+  x->hash = h;
+  x->bytes = bytes;
+  x->args = args;
+  x->result = lval_ref(result);
+  x->chain = m->buckets[h & (m->nbuckets-1)];
+  m->buckets[h & (m->nbuckets-1)] = x;
+  lmemo_push(m, x);
+  m->count++;
+  m->bytes += bytes;
 
-  lval_del(v);
-  return lval_sexpr();
+  while (m->count > m->max_entries || m->bytes > m->max_bytes) {
+    lmemo_evict(m);
+  }
+  return result;
 }
 
-/* Built-in operations */
-lval* builtin_op(lenv* e, lval* v, char* op) {
-  for (int i = 0; i < v->count; i++) {
-    LASSERT(v, v->cell[i]->type == LVAL_NUM,
-      "Function '%s' passed incorrect type for argument %i.\n Got %s, Expected %s.",
-      op, i, ltype_name(v->cell[i]->type), ltype_name(LVAL_NUM));
-  }
-  lval* x = lval_pop(v, 0);
-  if ((strcmp(op, "-") == 0) && v->count == 0) {
-    x->num = -x->num;
-  }
-  while (v->count > 0) {
-    lval* y = lval_pop(v, 0);
-    if (strcmp(op, "+") == 0) { x->num += y->num; }
-    if (strcmp(op, "-") == 0) { x->num -= y->num; }
-    if (strcmp(op, "*") == 0) { x->num *= y->num; }
-    if (strcmp(op, "/") == 0) {
-      if (y->num == 0) {
-        lval_del(x);
-        lval_del(y);
-        x = lval_err("Division by zero.");
-        break;
-      } else {
-          x-> num /= y->num;
-        }
-      }
-    if (strcmp(op, "%") == 0) { x->num %= y->num; }
-    if (strcmp(op, "^") == 0) { x->num = pow(x->num, y->num); }
-    if (strcmp(op, "min") == 0) { x->num = x->num > y->num ? y->num : x->num; }
-    if (strcmp(op, "max") == 0) { x->num = x->num > y->num ? x->num : y->num; }
+/**/
+/* Hash Maps */
+/**/
 
-    lval_del(y);
+static lmap_entry* lmap_find(lmap* m, unsigned long h, lval* k) {
+  int mask = m->cap - 1;
+  for (int i = h & mask; ; i = (i + 1) & mask) {
+    lmap_entry* s = &m->slots[i];
+    if (!s->key) { return s; }
+    if (s->hash == h && lval_eq(s->key, k)) { return s; }
   }
-  lval_del(v);
-  return x;
 }
 
-/* Arithmetic Operations */
-lval* builtin_add(lenv* e, lval* v) {
-  return builtin_op(e, v, "+");
+static void lmap_grow(lmap* m) {
+  lmap_entry* old = m->slots;
+  int cap = m->cap;
+  m->cap *= 2;
+  m->slots = calloc(m->cap, sizeof(lmap_entry));
+  for (int i = 0; i < cap; i++) {
+    if (old[i].key) { *lmap_find(m, old[i].hash, old[i].key) = old[i]; }
+  }
+  free(old);
 }
 
-lval* builtin_sub(lenv* e, lval* v) {
-  return builtin_op(e, v, "-");
+/* Borrowed value for k, or NULL */
+lval* lmap_get(lval* m, lval* k) {
+  lmap_entry* s = lmap_find(m->map, lval_hash(k), k);
+  return s->key ? s->val : NULL;
 }
 
-lval* builtin_mul(lenv* e, lval* v) {
-  return builtin_op(e, v, "*");
+/* Takes ownership of k and v; m must be uniquely owned */
+void lmap_put(lval* m, lval* k, lval* v) {
+  unsigned long h = lval_hash(k);
+  lmap_entry* s = lmap_find(m->map, h, k);
+  if (s->key) {
+    lval_del(k);
+    lval_del(s->val);
+    s->val = v;
+    return;
+  }
+  /* Only a new key can need the room */
+  if ((m->map->count + 1) * 4 > m->map->cap * 3) {
+    lmap_grow(m->map);
+    s = lmap_find(m->map, h, k);
+  }
+  s->hash = h;
+  s->key = k;
+  s->val = v;
+  m->map->count++;
 }
 
-lval* builtin_div(lenv* e, lval* v) {
-  return builtin_op(e, v, "/");
+/* Backward shift deletion keeps probe chains intact without tombstones */
+int lmap_del(lval* m, lval* k) {
+  lmap* map = m->map;
+  lmap_entry* s = lmap_find(map, lval_hash(k), k);
+  if (!s->key) { return 0; }
+  lval_del(s->key);
+  lval_del(s->val);
+  map->count--;
+
+  int mask = map->cap - 1;
+  int i = s - map->slots;
+  for (int j = (i + 1) & mask; map->slots[j].key; j = (j + 1) & mask) {
+    int home = map->slots[j].hash & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      map->slots[i] = map->slots[j];
+      i = j;
+    }
+  }
+  map->slots[i].key = NULL;
+  map->slots[i].val = NULL;
+  return 1;
 }
 
-lval* builtin_min(lenv* e, lval* v) {
-  return builtin_op(e, v, "min");
+/**/
+/* Hash-Consing */
+/**/
+
+void lcons_init(lcons* c) {
+  c->count = 0;
+  c->cap = 64;
+  c->slots = calloc(c->cap, sizeof(lval*));
 }
 
-lval* builtin_max(lenv* e, lval* v) {
-  return builtin_op(e, v, "max");
+/* Drops the table's references; nodes still in use outlive it */
+void lcons_free(lcons* c) {
+  for (int i = 0; i < c->cap; i++) {
+    if (c->slots[i]) { c->slots[i]->cons = NULL; }
+  }
+  for (int i = 0; i < c->cap; i++) {
+    if (c->slots[i]) { lval_del(c->slots[i]); }
+  }
+  free(c->slots);
 }
 
-lval* builtin_mod(lenv* e, lval* v) {
-  return builtin_op(e, v, "%");
+/* Children of both are already canonical, so lists match on pointers */
+static int lcons_same(lval* x, lval* y) {
+  if (x->type != y->type || x->hash != y->hash) { return 0; }
+  switch (x->type) {
+    case LVAL_NUM: return x->num == y->num;
+    case LVAL_SYM: return strcmp(x->sym, y->sym) == 0;
+    case LVAL_STR: return x->len == y->len && memcmp(x->str, y->str, x->len) == 0;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (x->count != y->count) { return 0; }
+      for (int i = 0; i < x->count; i++) {
+        if (x->cell[i] != y->cell[i]) { return 0; }
+      }
+      return 1;
+  }
+  return 0;
 }
 
-lval* builtin_exp(lenv* e, lval* v) {
-  return builtin_op(e, v, "^");
+static lval** lcons_find(lcons* c, lval* v) {
+  int mask = c->cap - 1;
+  for (int i = v->hash & mask; ; i = (i + 1) & mask) {
+    if (!c->slots[i] || lcons_same(c->slots[i], v)) { return &c->slots[i]; }
+  }
 }
 
-/* List Operations */
-lval* builtin_list(lenv* e, lval* v) {
-  v->type = LVAL_QEXPR;
+static void lcons_grow(lcons* c) {
+  lval** old = c->slots;
+  int cap = c->cap;
+  c->cap *= 2;
+  c->slots = calloc(c->cap, sizeof(lval*));
+  for (int i = 0; i < cap; i++) {
+    if (old[i]) { *lcons_find(c, old[i]) = old[i]; }
+  }
+  free(old);
+}
+
+/* Returns the canonical node equal to v, consuming v. Numbers, symbols,
+   strings and lists of those are interned bottom up; anything else is
+   returned as it is, and so is any list holding it. */
+lval* lcons_intern(lcons* c, lval* v) {
+  if (v->cons) { return v; }
+  switch (v->type) {
+    case LVAL_NUM:
+    case LVAL_SYM:
+    case LVAL_STR:
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      for (int i = 0; i < v->count; i++) {
+        v->cell[i] = lcons_intern(c, v->cell[i]);
+      }
+      for (int i = 0; i < v->count; i++) {
+        if (!v->cell[i]->cons) { return v; }
+      }
+      break;
+    default:
+      return v;
+  }
+
+  v->hash = lval_hash(v);
+  if ((c->count + 1) * 4 > c->cap * 3) { lcons_grow(c); }
+  lval** s = lcons_find(c, v);
+  if (*s) {
+    lval* x = lval_ref(*s);
+    lval_del(v);
+    return x;
+  }
+  v->cons = c;
+  v->refs++;
+  *s = v;
+  c->count++;
   return v;
 }
 
-lval* builtin_len(lenv* e, lval* v) {
+/* Backward shift deletion, as for hash maps */
+static void lcons_remove(lval* v) {
+  lcons* c = v->cons;
+  int mask = c->cap - 1;
+  int i = v->hash & mask;
+  while (c->slots[i] != v) { i = (i + 1) & mask; }
+  for (int j = (i + 1) & mask; c->slots[j]; j = (j + 1) & mask) {
+    int home = c->slots[j]->hash & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      c->slots[i] = c->slots[j];
+      i = j;
+    }
+  }
+  c->slots[i] = NULL;
+  c->count--;
+  v->cons = NULL;
+  lval_del(v);
+}
+
+/**/
+/* Lazy Sequences */
+/**/
+
+/* True when every element can be produced as a raw long */
+int lseq_numeric(lval* s) {
+  switch (s->seq->kind) {
+    case LSEQ_RANGE:
+    case LSEQ_NUMS: return 1;
+    case LSEQ_TAKE:
+    case LSEQ_DROP: return lseq_numeric(s->seq->src);
+  }
+  return 0;
+}
+
+/* Elements left in a range. The distances are taken in unsigned
+   arithmetic, which holds any span between two longs. */
+static unsigned long lrange_left(lseq* r) {
+  if (r->step > 0) {
+    return r->cur < r->end
+      ? ((unsigned long)r->end - (unsigned long)r->cur - 1) / r->step + 1 : 0;
+  }
+  return r->cur > r->end
+    ? ((unsigned long)r->cur - (unsigned long)r->end - 1)
+      / (0UL - (unsigned long)r->step) + 1 : 0;
+}
+
+/* Moves a range on by n elements. Stepping past the last element could
+   leave the range of a long, so a range used up stops at its end. */
+static void lrange_skip(lseq* r, unsigned long n) {
+  if (n >= lrange_left(r)) {
+    r->cur = r->end;
+  } else {
+    r->cur = (long)((unsigned long)r->cur + n * (unsigned long)r->step);
+  }
+}
+
+/* Unboxed pull for numeric chains; returns 0 once exhausted */
+int lseq_next_num(lval* s, long* buf, int max) {
+  lseq* q = s->seq;
+  int k = 0;
+  switch (q->kind) {
+    case LSEQ_RANGE: {
+      unsigned long left = lrange_left(q);
+      k = left < (unsigned long)max ? left : max;
+      unsigned long cur = q->cur, step = q->step;
+      for (int i = 0; i < k; i++) { buf[i] = (long)(cur + i * step); }
+      lrange_skip(q, k);
+      return k;
+    }
+
+    /* Numbers read from a file are copied out a block at a time */
+    case LSEQ_NUMS:
+      k = q->end - q->cur < max ? q->end - q->cur : max;
+      memcpy(buf, q->nums->data + q->cur, sizeof(long) * k);
+      q->cur += k;
+      return k;
+
+    case LSEQ_TAKE:
+      if (q->n <= 0) { return 0; }
+      k = lseq_next_num(q->src, buf, q->n < max ? q->n : max);
+      q->n -= k;
+      return k;
+
+    case LSEQ_DROP:
+      /* A range is skipped arithmetically */
+      if (q->n > 0 && q->src->seq->kind == LSEQ_RANGE) {
+        lrange_skip(q->src->seq, q->n);
+        q->n = 0;
+      }
+      if (q->n > 0 && q->src->seq->kind == LSEQ_NUMS) {
+        lseq* r = q->src->seq;
+        r->cur += q->n < r->end - r->cur ? q->n : r->end - r->cur;
+        q->n = 0;
+      }
+      while (q->n > 0) {
+        k = lseq_next_num(q->src, buf, q->n < max ? q->n : max);
+        if (k == 0) { return 0; }
+        q->n -= k;
+      }
+      return lseq_next_num(q->src, buf, max);
+  }
+  return 0;
+}
+
+/* Calls predicate f on the arguments a (consumed); nonzero numbers are
+   true. Any other result is reported through err. */
+static int lval_pred(lenv* e, lval* f, lval* a, char* name, lval** err) {
+  lval* r = lval_call(e, f, a);
+  if (r->type != LVAL_NUM) {
+    if (r->type == LVAL_ERR) {
+      *err = r;
+    } else {
+      *err = lval_err(
+        "Function '%s' predicate returned invalid type.\nGot %s, Expected %s.",
+        name, ltype_name(r->type), ltype_name(LVAL_NUM));
+      lval_del(r);
+    }
+    return 0;
+  }
+  int t = r->num != 0;
+  lval_del(r);
+  return t;
+}
+
+static lval* lbin_get(const unsigned char** p, const unsigned char* end,
+  int depth);
+static void lreader_release(lreader* r);
+
+/* Boxed pull of up to max elements into buf; returns 0 once exhausted.
+   An error ends the chunk and is left as its last element. */
+int lseq_next(lenv* e, lval* s, lval** buf, int max) {
+  lseq* q = s->seq;
+  int k = 0;
+
+  if (lseq_numeric(s)) {
+    long* nums = malloc(sizeof(long) * LSEQ_CHUNK);
+    k = lseq_next_num(s, nums, max < LSEQ_CHUNK ? max : LSEQ_CHUNK);
+    for (int i = 0; i < k; i++) { buf[i] = lval_num(nums[i]); }
+    free(nums);
+    return k;
+  }
+
+  switch (q->kind) {
+    case LSEQ_TAKE:
+      if (q->n <= 0) { return 0; }
+      k = lseq_next(e, q->src, buf, q->n < max ? q->n : max);
+      q->n -= k;
+      return k;
+
+    case LSEQ_DROP:
+      while (q->n > 0) {
+        k = lseq_next(e, q->src, buf, q->n < max ? q->n : max);
+        if (k == 0) { return 0; }
+        if (buf[k-1]->type == LVAL_ERR) {
+          for (int i = 0; i < k-1; i++) { lval_del(buf[i]); }
+          buf[0] = buf[k-1];
+          return 1;
+        }
+        for (int i = 0; i < k; i++) { lval_del(buf[i]); }
+        q->n -= k;
+      }
+      return lseq_next(e, q->src, buf, max);
+
+    case LSEQ_MAP:
+      k = lseq_next(e, q->src, buf, max);
+      for (int i = 0; i < k; i++) {
+        if (buf[i]->type == LVAL_ERR) { return i+1; }
+        buf[i] = lval_call(e, q->fn, lval_add(lval_sexpr(), buf[i]));
+        if (buf[i]->type == LVAL_ERR) {
+          for (int j = i+1; j < k; j++) { lval_del(buf[j]); }
+          return i+1;
+        }
+      }
+      return k;
+
+    case LSEQ_FILTER:
+      while (1) {
+        int n = lseq_next(e, q->src, buf, max);
+        if (n == 0) { return 0; }
+        k = 0;
+        for (int i = 0; i < n; i++) {
+          if (buf[i]->type == LVAL_ERR) { buf[k++] = buf[i]; return k; }
+          lval* err = NULL;
+          lval* a = lval_add(lval_sexpr(), lval_ref(buf[i]));
+          if (lval_pred(e, q->fn, a, "filter", &err)) {
+            buf[k++] = buf[i];
+          } else {
+            lval_del(buf[i]);
+          }
+          if (err) {
+            for (int j = i+1; j < n; j++) { lval_del(buf[j]); }
+            buf[k++] = err;
+            return k;
+          }
+        }
+        if (k > 0) { return k; }
+      }
+
+    /* Elements of a saved list are decoded as they are pulled */
+    case LSEQ_FILE: {
+      lreader* r = &q->bin->r;
+      const unsigned char* p = (const unsigned char*)r->data + q->cur;
+      const unsigned char* end = (const unsigned char*)r->data + r->len;
+      for (; k < max && q->n > 0; q->n--) {
+        lval* x = lbin_get(&p, end, 0);
+        if (!x) {
+          q->n = 0;
+          buf[k++] = lval_err("Saved file is corrupt.");
+          break;
+        }
+        buf[k++] = x;
+      }
+      q->cur = p - (const unsigned char*)r->data;
+      if (q->cur > (long)r->pos) {
+        r->pos = q->cur;
+        lreader_release(r);
+      }
+      return k;
+    }
+  }
+  return 0;
+}
+
+/**/
+/* Green Threads */
+/**/
+
+#ifdef LTASK_ASM
+/* Pushes the callee-saved registers, stores the stack pointer in *from,
+   then switches to stack to and pops the registers saved there */
+__asm__(
+  ".text\n"
+  ".globl ltask_swap\n"
+  ".hidden ltask_swap\n"
+  ".type ltask_swap, @function\n"
+  "ltask_swap:\n"
+  "  pushq %rbp\n"
+  "  pushq %rbx\n"
+  "  pushq %r12\n"
+  "  pushq %r13\n"
+  "  pushq %r14\n"
+  "  pushq %r15\n"
+  "  movq %rsp, (%rdi)\n"
+  "  movq %rsi, %rsp\n"
+  "  popq %r15\n"
+  "  popq %r14\n"
+  "  popq %r13\n"
+  "  popq %r12\n"
+  "  popq %rbx\n"
+  "  popq %rbp\n"
+  "  ret\n"
+  ".size ltask_swap, .-ltask_swap\n"
+);
+#endif
+
+static void ltask_push(ltask_queue* q, ltask* t) {
+  t->next = NULL;
+  if (q->tail) { q->tail->next = t; } else { q->head = t; }
+  q->tail = t;
+}
+
+static ltask* ltask_pop(ltask_queue* q) {
+  ltask* t = q->head;
+  if (t) {
+    q->head = t->next;
+    if (!q->head) { q->tail = NULL; }
+  }
+  return t;
+}
+
+static void ltask_remove(ltask_queue* q, ltask* t) {
+  ltask* prev = NULL;
+  for (ltask* x = q->head; x; prev = x, x = x->next) {
+    if (x != t) { continue; }
+    if (prev) { prev->next = t->next; } else { q->head = t->next; }
+    if (q->tail == t) { q->tail = prev; }
+    return;
+  }
+}
+
+/* The stack of a finished task is released once it has been left */
+static void ltask_reap(lsched* s) {
+  if (s->zombie) {
+    munmap(s->zombie, LTASK_STACK);
+    s->zombie = NULL;
+  }
+}
+
+static void ltask_switch(lsched* s, ltask* from, ltask* to) {
+  if (lcur->limit) {
+    from->depth = lcur->limit->depth;
+    lcur->limit->depth = to->depth;
+    from->top = lcur->limit->stack;
+    lcur->limit->stack = to->top;
+  }
+  if (lcur->prof) {
+    from->prof = lcur->prof->top;
+    lcur->prof->top = to->prof;
+  }
+  s->current = to;
+  to->state = LTASK_RUNNING;
+#ifdef LTASK_ASM
+  ltask_swap(&from->sp, to->sp);
+#else
+  swapcontext(&from->ctx, &to->ctx);
+#endif
+  ltask_reap(s);
+}
+
+static lval* lval_detach(lval* v);
+static int lval_pins(lval* v);
+
+/* First frame of every task; it never returns */
+static void ltask_main(void) {
+  lsched* s = lcur->sched;
+  ltask* t = s->current;
+  ltask_reap(s);
+
+  lval* args = t->args;
+  t->args = NULL;
+  t->result = lval_call(s->env, t->fn, args);
+  lval_del(t->fn);
+  t->fn = NULL;
+  /* A result waiting to be joined should not hold the epoch back */
+  if (lcur->epoch) {
+    t->result = lval_detach(t->result);
+    t->pinned = lval_pins(t->result);
+  }
+  t->state = LTASK_DONE;
+  while (t->joiners.head) { lsched_wake(&t->joiners); }
+
+  /* With nothing left to run the main task must be waiting on something
+     no task can provide; it is resumed to report the deadlock */
+  ltask* next = ltask_pop(&s->ready);
+  if (!next) {
+    next = &s->main;
+    if (next->wait) { ltask_remove(next->wait, next); }
+    next->deadlock = 1;
+  }
+  s->zombie = t->stack;
+  t->stack = NULL;
+  ltask_switch(s, t, next);
+}
+
+void lsched_init(lsched* s, lenv* env) {
+  s->main.id = 0;
+  s->main.state = LTASK_RUNNING;
+  s->main.deadlock = 0;
+  s->main.pinned = 0;
+  s->main.stack = NULL;
+  s->main.top = NULL;
+  s->main.depth = 0;
+  s->main.prof = NULL;
+  s->main.fn = NULL;
+  s->main.args = NULL;
+  s->main.result = NULL;
+  s->main.joiners.head = s->main.joiners.tail = NULL;
+  s->main.wait = NULL;
+  s->current = &s->main;
+  s->tasks = malloc(sizeof(ltask*));
+  s->tasks[0] = &s->main;
+  s->count = 1;
+  s->ready.head = s->ready.tail = NULL;
+  s->zombie = NULL;
+  s->slice = LTASK_SLICE;
+  s->env = env;
+}
+
+/* Tasks still suspended are resumed with the evaluation stopped, so they
+   unwind and their frames free what they hold; then results nobody
+   joined are released. Runs in the context of s's instance. */
+void lsched_free(lsched* s) {
+  llimit* l = lcur->limit;
+  if (l && lcur->sched == s && s->current == &s->main) {
+    l->stop = "Evaluation cancelled.";
+    for (;;) {
+      int live = 0;
+      for (int i = 1; i < s->count; i++) {
+        ltask* t = s->tasks[i];
+        if (!t || t->state == LTASK_DONE) { continue; }
+        live = 1;
+        /* A block fails as if no task could ever wake it */
+        if (t->state == LTASK_BLOCKED) {
+          ltask_remove(t->wait, t);
+          t->wait = NULL;
+          t->deadlock = 1;
+          t->state = LTASK_READY;
+          ltask_push(&s->ready, t);
+        }
+      }
+      if (!live) { break; }
+      lsched_yield();
+    }
+    s->main.deadlock = 0;
+  }
+  for (int i = 1; i < s->count; i++) {
+    ltask* t = s->tasks[i];
+    if (!t) { continue; }
+    if (t->stack) { munmap(t->stack, LTASK_STACK); }
+    if (t->fn) { lval_del(t->fn); }
+    if (t->args) { lval_del(t->args); }
+    if (t->result) { lval_del(t->result); }
+    free(t);
+  }
+  ltask_reap(s);
+  free(s->tasks);
+}
+
+/* True while tasks are suspended, or finished with a result nobody has
+   joined that still refers into a shared env */
+static int lsched_busy(lsched* s) {
+  for (int i = 1; i < s->count; i++) {
+    ltask* t = s->tasks[i];
+    if (t && (t->state != LTASK_DONE || t->pinned)) { return 1; }
+  }
+  return 0;
+}
+
+/* Creates a ready task that will apply fn to args; takes ownership */
+static ltask* ltask_new(lsched* s, lval* fn, lval* args) {
+  char* stack = mmap(NULL, LTASK_STACK, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (stack == MAP_FAILED) { return NULL; }
+  /* Guard page, so an overflow faults instead of corrupting memory */
+  mprotect(stack, sysconf(_SC_PAGESIZE), PROT_NONE);
+
+  ltask* t = malloc(sizeof(ltask));
+  t->id = s->count;
+  t->state = LTASK_READY;
+  t->deadlock = 0;
+  t->pinned = 0;
+  t->stack = stack;
+  t->top = stack + LTASK_STACK;
+  t->depth = 0;
+  t->prof = NULL;
+  t->fn = fn;
+  t->args = args;
+  t->result = NULL;
+  t->joiners.head = t->joiners.tail = NULL;
+  t->wait = NULL;
+
+#ifdef LTASK_ASM
+  /* Six zeroed registers and a return into ltask_main, aligned as if
+     ltask_main had just been called */
+  void** sp = (void**)(stack + LTASK_STACK);
+  *--sp = NULL;
+  *--sp = (void*)ltask_main;
+  for (int i = 0; i < 6; i++) { *--sp = NULL; }
+  t->sp = sp;
+#else
+  getcontext(&t->ctx);
+  t->ctx.uc_stack.ss_sp = stack;
+  t->ctx.uc_stack.ss_size = LTASK_STACK;
+  t->ctx.uc_link = NULL;
+  makecontext(&t->ctx, ltask_main, 0);
+#endif
+
+  s->tasks = realloc(s->tasks, sizeof(ltask*) * (s->count + 1));
+  s->tasks[s->count++] = t;
+  ltask_push(&s->ready, t);
+  return t;
+}
+
+/* Lets the next ready task run; returns 0 if there was none */
+int lsched_yield(void) {
+  lsched* s = lcur->sched;
+  ltask* next = s ? ltask_pop(&s->ready) : NULL;
+  if (!next) { return 0; }
+  ltask* t = s->current;
+  t->state = LTASK_READY;
+  ltask_push(&s->ready, t);
+  ltask_switch(s, t, next);
+  return 1;
+}
+
+/* Safe point: the running task gives way once its slice is used up */
+void lsched_preempt(void) {
+  lsched* s = lcur->sched;
+  if (--s->slice > 0) { return; }
+  s->slice = LTASK_SLICE;
+  lsched_yield();
+}
+
+/* Parks the running task on q until woken. Returns 0 instead when no
+   other task could ever wake it. */
+int lsched_block(ltask_queue* q) {
+  lsched* s = lcur->sched;
+  ltask* next = s ? ltask_pop(&s->ready) : NULL;
+  if (!next) { return 0; }
+  ltask* t = s->current;
+  t->state = LTASK_BLOCKED;
+  t->wait = q;
+  ltask_push(q, t);
+  ltask_switch(s, t, next);
+  if (t->deadlock) {
+    t->deadlock = 0;
+    return 0;
+  }
+  return 1;
+}
+
+/* Makes the first task parked on q ready */
+void lsched_wake(ltask_queue* q) {
+  ltask* t = ltask_pop(q);
+  if (!t) { return; }
+  t->state = LTASK_READY;
+  t->wait = NULL;
+  ltask_push(&lcur->sched->ready, t);
+}
+
+/**/
+/* Native Code for Arithmetic */
+/**/
+
+#ifdef LJIT
+
+/* Global value of sym, or NULL, noted in deps. Unresolved symbols are
+   only looked up globally at the top level, where no frame can shadow them. */
+static lval* ljit_global(lenv* e, lenv* root, lval* sym, lbuf* deps) {
+  if (sym->slot == LSLOT_NONE && e != root) { return NULL; }
+  for (int i = 0; i < root->count; i++) {
+    if (strcmp(root->syms[i], sym->sym) == 0) {
+      ljit_dep d = { i, root->vals[i] };
+      lbuf_put(deps, (char*)&d, sizeof(d));
+      return root->vals[i];
+    }
+  }
+  return NULL;
+}
+
+static void ljit_imm32(lbuf* b, int n) { lbuf_put(b, (char*)&n, 4); }
+static void ljit_imm64(lbuf* b, long n) { lbuf_put(b, (char*)&n, 8); }
+
+/* Conditional jump to the bail out path, patched once its address is known */
+static void ljit_bail(lbuf* b, lbuf* fails, const char* jcc) {
+  lbuf_put(b, jcc, 2);
+  size_t at = b->len;
+  lbuf_put(fails, (char*)&at, sizeof(size_t));
+  ljit_imm32(b, 0);
+}
+
+/* Number known when compiling: a literal or a global bound to a number */
+static int ljit_const(lenv* e, lenv* root, lval* x, long* n, lbuf* deps) {
+  if (x->type == LVAL_NUM) { *n = x->num; return 1; }
+  if (x->type != LVAL_SYM || x->slot >= 0) { return 0; }
+  lval* g = ljit_global(e, root, x, deps);
+  if (!g || g->type != LVAL_NUM) { return 0; }
+  *n = g->num;
+  return 1;
+}
+
+static int ljit_expr(lenv* e, lenv* root, lval* v, lbuf* b, lbuf* fails,
+  lbuf* deps);
+
+/* Emits code leaving the value of x in rax. The frame is held in rbx. */
+static int ljit_arg(lenv* e, lenv* root, lval* x, lbuf* b, lbuf* fails,
+    lbuf* deps) {
+  long n;
+  if (ljit_const(e, root, x, &n, deps)) {
+    lbuf_put(b, "\x48\xB8", 2); ljit_imm64(b, n);        /* mov rax, n */
+    return 1;
+  }
+  if (x->type == LVAL_SYM && x->slot >= 0) {
+    lbuf_put(b, "\x48\x89\xD9", 3);                      /* mov rcx, rbx */
+    for (int d = x->depth; d > 0; d--) {
+      lbuf_put(b, "\x48\x8B\x89", 3);                    /* mov rcx, [rcx+par] */
+      ljit_imm32(b, offsetof(lenv, par));
+    }
+    lbuf_put(b, "\x48\x8B\x89", 3);                      /* mov rcx, [rcx+vals] */
+    ljit_imm32(b, offsetof(lenv, vals));
+    lbuf_put(b, "\x48\x8B\x89", 3);                      /* mov rcx, [rcx+slot] */
+    ljit_imm32(b, x->slot * sizeof(lval*));
+    lbuf_put(b, "\x81\xB9", 2);                          /* cmp [rcx+type], NUM */
+    ljit_imm32(b, offsetof(lval, type));
+    ljit_imm32(b, LVAL_NUM);
+    ljit_bail(b, fails, "\x0F\x85");                     /* jne bail */
+    lbuf_put(b, "\x48\x8B\x81", 3);                      /* mov rax, [rcx+num] */
+    ljit_imm32(b, offsetof(lval, num));
+    return 1;
+  }
+  if (x->type == LVAL_SEXPR) { return ljit_expr(e, root, x, b, fails, deps); }
+  return 0;
+}
+
+/* Emits code for an arithmetic builtin applied to compilable arguments.
+   Anything the interpreter would wrap or report as an error bails out. */
+static int ljit_expr(lenv* e, lenv* root, lval* v, lbuf* b, lbuf* fails,
+    lbuf* deps) {
+  if (v->count < 2 || v->cell[0]->type != LVAL_SYM) { return 0; }
+  if (v->cell[0]->slot >= 0) { return 0; }
+  lval* f = ljit_global(e, root, v->cell[0], deps);
+  if (!f || f->type != LVAL_FUN || !f->fun) { return 0; }
+  char* name = builtin_op_name(f->fun);
+  int op = name ? lop_code(name) : LOP_NONE;
+  if (op == LOP_NONE || op == LOP_EXP) { return 0; }
+
+  if (!ljit_arg(e, root, v->cell[1], b, fails, deps)) { return 0; }
+  if (op == LOP_SUB && v->count == 2) {
+    lbuf_put(b, "\x48\xF7\xD8", 3);                      /* neg rax */
+    ljit_bail(b, fails, "\x0F\x80");                     /* jo bail */
+  }
+
+  for (int i = 2; i < v->count; i++) {
+    long n;
+    if (ljit_const(e, root, v->cell[i], &n, deps)) {
+      lbuf_put(b, "\x48\xB9", 2); ljit_imm64(b, n);      /* mov rcx, n */
+    } else {
+      lbuf_putc(b, '\x50');                              /* push rax */
+      if (!ljit_arg(e, root, v->cell[i], b, fails, deps)) { return 0; }
+      lbuf_put(b, "\x48\x89\xC1\x58", 4);                /* mov rcx, rax; pop rax */
+    }
+    switch (op) {
+      case LOP_ADD:
+        lbuf_put(b, "\x48\x01\xC8", 3);                  /* add rax, rcx */
+        ljit_bail(b, fails, "\x0F\x80");
+        break;
+      case LOP_SUB:
+        lbuf_put(b, "\x48\x29\xC8", 3);                  /* sub rax, rcx */
+        ljit_bail(b, fails, "\x0F\x80");
+        break;
+      case LOP_MUL:
+        lbuf_put(b, "\x48\x0F\xAF\xC1", 4);              /* imul rax, rcx */
+        ljit_bail(b, fails, "\x0F\x80");
+        break;
+      case LOP_DIV:
+      case LOP_MOD:
+        lbuf_put(b, "\x48\x85\xC9", 3);                  /* test rcx, rcx */
+        ljit_bail(b, fails, "\x0F\x84");                 /* jz bail */
+        lbuf_put(b, "\x48\x83\xF9\xFF", 4);              /* cmp rcx, -1 */
+        ljit_bail(b, fails, "\x0F\x84");                 /* je bail */
+        lbuf_put(b, "\x48\x99\x48\xF7\xF9", 5);          /* cqo; idiv rcx */
+        if (op == LOP_MOD) {
+          lbuf_put(b, "\x48\x89\xD0", 3);                /* mov rax, rdx */
+        }
+        break;
+      case LOP_MIN:
+        lbuf_put(b, "\x48\x39\xC8\x48\x0F\x4F\xC1", 7);  /* cmp; cmovg rax, rcx */
+        break;
+      case LOP_MAX:
+        lbuf_put(b, "\x48\x39\xC8\x48\x0F\x4C\xC1", 7);  /* cmp; cmovl rax, rcx */
+        break;
+    }
+  }
+  return 1;
+}
+
+/* Compiles v to int fn(lenv* frame, long* out), which returns 0 when the
+   interpreter has to take over. Returns NULL if v is not compilable. */
+static ljit* ljit_compile(lenv* e, lenv* root, lval* v) {
+  lbuf b, fails, deps;
+  lbuf_init(&b, -1);
+  lbuf_init(&fails, -1);
+  lbuf_init(&deps, -1);
+
+  /* push rbp; mov rbp, rsp; push rbx; push r12; mov rbx, rdi; mov r12, rsi */
+  lbuf_put(&b, "\x55\x48\x89\xE5\x53\x41\x54\x48\x89\xFB\x49\x89\xF4", 13);
+  int ok = ljit_expr(e, root, v, &b, &fails, &deps);
+
+  /* mov [r12], rax; mov eax, 1; jmp done; bail: xor eax, eax */
+  lbuf_put(&b, "\x49\x89\x04\x24\xB8\x01\x00\x00\x00\xEB\x02", 11);
+  size_t bail = b.len;
+  lbuf_put(&b, "\x31\xC0", 2);
+  /* done: lea rsp, [rbp-16]; pop r12; pop rbx; pop rbp; ret */
+  lbuf_put(&b, "\x48\x8D\x65\xF0\x41\x5C\x5B\x5D\xC3", 9);
+
+  for (size_t i = 0; i < fails.len; i += sizeof(size_t)) {
+    size_t at;
+    memcpy(&at, fails.data + i, sizeof(size_t));
+    int rel = (int)(bail - (at + 4));
+    memcpy(b.data + at, &rel, 4);
+  }
+
+  ljit* j = NULL;
+  if (ok) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (b.len + page - 1) / page * page;
+    void* code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code != MAP_FAILED) {
+      memcpy(code, b.data, b.len);
+      if (mprotect(code, size, PROT_READ | PROT_EXEC) == 0) {
+        j = malloc(sizeof(ljit));
+        j->code = code;
+        j->size = size;
+        j->root = root;
+        j->version = root->version;
+        j->ndeps = deps.len / sizeof(ljit_dep);
+        j->deps = malloc(deps.len);
+        memcpy(j->deps, deps.data, deps.len);
+        for (int i = 0; i < j->ndeps; i++) { lval_ref(j->deps[i].val); }
+      } else {
+        munmap(code, size);
+      }
+    }
+  }
+  free(b.data);
+  free(fails.data);
+  free(deps.data);
+  return j;
+}
+
+/* True if j can run for root: every global it read is still bound to the
+   value it compiled against, whatever else has been defined since */
+static int ljit_valid(ljit* j, lenv* root) {
+  if (j->root != root) { return 0; }
+  if (j->version == root->version) { return 1; }
+  for (int i = 0; i < j->ndeps; i++) {
+    if (root->vals[j->deps[i].slot] != j->deps[i].val) { return 0; }
+  }
+  j->version = root->version;
+  return 1;
+}
+
+static int lload_recording(void);
+
+/* Runs the native code for v, compiling it first if needed. Returns 0
+   when v must be evaluated by the interpreter instead. */
+int ljit_run(lenv* e, lval* v, long* out) {
+  lenv* root = e;
+  while (root->par) { root = root->par; }
+
+  /* Compiled code reads globals without the care a shared env needs */
+  if (root->shared) {
+    v->hot = 0;
+    return 0;
+  }
+
+  /* Nor does it note the globals it reads, which a load is recording */
+  if (lload_recording()) {
+    v->hot = 0;
+    return 0;
+  }
+
+  /* A redefinition may have changed a global the code depends on */
+  if (v->jit && !ljit_valid(v->jit, root)) {
+    ljit_free(v->jit);
+    v->jit = NULL;
+    v->hot = 0;
+    return 0;
+  }
+  /* hot stays at LJIT_HOT, so v is not compiled again */
+  if (!v->jit && !(v->jit = ljit_compile(e, root, v))) { return 0; }
+  int (*fn)(lenv*, long*) = (int (*)(lenv*, long*))v->jit->code;
+  return fn(e, out);
+}
+
+void ljit_free(ljit* j) {
+  munmap(j->code, j->size);
+  for (int i = 0; i < j->ndeps; i++) { lval_del(j->deps[i].val); }
+  free(j->deps);
+  free(j);
+}
+
+#else
+
+int ljit_run(lenv* e, lval* v, long* out) { return 0; }
+void ljit_free(ljit* j) {}
+
+#endif
+
+/**/
+/* Shared Environments */
+/**/
+
+/* One lock orders all writers to shared envs, with the bookkeeping
+   below; readers never take it */
+static pthread_mutex_t lshare_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Anything unlinked from a shared env waits here, oldest first, until no
+   evaluator can still be looking at it */
+typedef struct lretire {
+  void* p;
+  int kind;
+  unsigned long epoch;
+  struct lretire* next;
+} lretire;
+
+enum { LRETIRE_MEM, LRETIRE_VAL, LRETIRE_ENV };
+
+static unsigned long lepoch_now = 1;
+static lepoch* lepoch_all;
+static lretire* lretire_head;
+static lretire* lretire_tail;
+
+/* Memos, sequences and channels change as they are used */
+static char* lval_unshareable(lval* v) {
+  switch (v->type) {
+    case LVAL_SEQ:
+    case LVAL_CHAN:
+      return ltype_name(v->type);
+    case LVAL_FUN:
+      if (v->memo) { return "Memoized Function"; }
+      if (!v->fun) {
+        for (lenv* f = v->env; f->par; f = f->par) {
+          for (int i = 0; i < f->count; i++) {
+            char* t = lval_unshareable(f->vals[i]);
+            if (t) { return t; }
+          }
+        }
+      }
+      return NULL;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      for (int i = 0; i < v->count; i++) {
+        char* t = lval_unshareable(v->cell[i]);
+        if (t) { return t; }
+      }
+      return NULL;
+    case LVAL_MAP:
+      for (int i = 0; i < v->map->cap; i++) {
+        if (!v->map->slots[i].key) { continue; }
+        char* t = lval_unshareable(v->map->slots[i].val);
+        if (t) { return t; }
+      }
+      return NULL;
+    default:
+      return NULL;
+  }
+}
+
+static void lretire_push(lretire* r) {
+  r->next = NULL;
+  if (lretire_tail) {
+    lretire_tail->next = r;
+  } else {
+    __atomic_store_n(&lretire_head, r, __ATOMIC_RELAXED);
+  }
+  lretire_tail = r;
+}
+
+/* Queues p to be freed once every evaluator has moved past the current
+   epoch. A value or frame records in *queued the epoch it was last
+   unlinked in, so one linked again and dropped while still waiting is
+   not queued twice. */
+static void lepoch_retire(void* p, int kind, unsigned long* queued) {
+  if (queued) {
+    int waiting = *queued != 0;
+    *queued = lepoch_now;
+    if (waiting) { return; }
+  }
+  lretire* r = malloc(sizeof(lretire));
+  r->p = p;
+  r->kind = kind;
+  r->epoch = lepoch_now;
+  lretire_push(r);
+}
+
+static void lenv_share_frame(lenv* f);
+static void lenv_drop(lenv* f);
+
+/* Adds an edge into v from a shared env, frame or value. The first one
+   marks v and everything it reaches as shared; only writers, holding
+   the lock, change a shared value's edge count. */
+static void lval_share(lval* v) {
+  if (v->refs == LREFS_SHARED) {
+    v->edges++;
+    return;
+  }
+  /* The hash-consing table would outlive the value. Shared values are
+     never interned, so hash is free to hold the epoch of lepoch_retire. */
+  if (v->cons) {
+    lcons_remove(v);
+    v->cons = NULL;
+  }
+  v->refs = LREFS_SHARED;
+  v->edges = 1;
+  v->hash = 0;
+  switch (v->type) {
+    case LVAL_FUN:
+      if (!v->fun) {
+        lenv_share_frame(v->env);
+        lval_share(v->formals);
+        lval_share(v->body);
+      }
+      break;
+    case LVAL_STR:
+      if (!v->strbuf) { break; }
+      if (v->strbuf->refs == LREFS_SHARED) {
+        v->strbuf->edges++;
+      } else {
+        v->strbuf->refs = LREFS_SHARED;
+        v->strbuf->edges = 1;
+      }
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (v->jit) {
+        ljit_free(v->jit);
+        v->jit = NULL;
+      }
+      for (int i = 0; i < v->count; i++) { lval_share(v->cell[i]); }
+      break;
+    case LVAL_MAP:
+      for (int i = 0; i < v->map->cap; i++) {
+        if (v->map->slots[i].key) {
+          lval_share(v->map->slots[i].key);
+          lval_share(v->map->slots[i].val);
+        }
+      }
+      break;
+  }
+}
+
+static void lval_drop(lval* v) {
+  if (--v->edges == 0) { lepoch_retire(v, LRETIRE_VAL, &v->hash); }
+}
+
+/* Frees a shared value nothing links to any more */
+static void lval_free_shared(lval* v) {
+  switch (v->type) {
+    case LVAL_FUN:
+      if (!v->fun) {
+        lenv_drop(v->env);
+        lval_drop(v->formals);
+        lval_drop(v->body);
+      }
+      break;
+    case LVAL_ERR: free(v->err); break;
+    case LVAL_SYM: free(v->sym); break;
+    case LVAL_STR:
+      if (v->strbuf && --v->strbuf->edges == 0) { free(v->strbuf); }
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      for (int i = 0; i < v->count; i++) { lval_drop(v->cell[i]); }
+      free(v->cell);
+      break;
+    case LVAL_MAP:
+      for (int i = 0; i < v->map->cap; i++) {
+        if (v->map->slots[i].key) {
+          lval_drop(v->map->slots[i].key);
+          lval_drop(v->map->slots[i].val);
+        }
+      }
+      free(v->map->slots);
+      free(v->map);
+      break;
+  }
+  free(v);
+}
+
+/* Closure frames are immutable, so they are shared like values. The
+   global env counts the closures under it as well as its owner, and
+   outlives them all. */
+static void lenv_share_frame(lenv* f) {
+  if (f->refs == LREFS_SHARED || !f->par) {
+    f->edges++;
+    return;
+  }
+  /* Only a global env uses version, for compiled code */
+  f->refs = LREFS_SHARED;
+  f->edges = 1;
+  f->version = 0;
+  /* The formals may be freed first, so it takes its own names */
+  if (f->formals) {
+    for (int i = 0; i < f->formals->count; i++) {
+      char* s = f->syms[i];
+      f->syms[i] = malloc(strlen(s) + 1);
+      strcpy(f->syms[i], s);
+    }
+    lval_del(f->formals);
+    f->formals = NULL;
+  }
+  for (int i = 0; i < f->count; i++) { lval_share(f->vals[i]); }
+  lenv_share_frame(f->par);
+}
+
+static void lenv_drop(lenv* f) {
+  if (--f->edges > 0) { return; }
+  if (f->par) {
+    lepoch_retire(f, LRETIRE_ENV, &f->version);
+  } else {
+    free(f);
+  }
+}
+
+static void lenv_free_frame(lenv* f) {
+  for (int i = 0; i < f->count; i++) {
+    free(f->syms[i]);
+    lval_drop(f->vals[i]);
+  }
+  free(f->syms);
+  free(f->vals);
+  lenv_drop(f->par);
+  free(f);
+}
+
+/* Frees what no evaluator can reach. The epoch moves on once every
+   evaluator has announced the current one, and whatever was retired two
+   epochs back is then unreachable. With no evaluator inside the env at
+   all, everything queued is. */
+static void lepoch_reclaim(void) {
+  int idle = 1;
+  int behind = 0;
+  for (lepoch* p = lepoch_all; p; p = p->next) {
+    unsigned long e = __atomic_load_n(&p->epoch, __ATOMIC_SEQ_CST);
+    if (e) { idle = 0; }
+    if (e && e != lepoch_now) { behind = 1; }
+  }
+  if (!behind) { __atomic_store_n(&lepoch_now, lepoch_now + 1, __ATOMIC_SEQ_CST); }
+
+  /* Freed values are charged to no evaluation */
+  lctx c = *lcur;
+  c.limit = NULL;
+  lctx* prev = lctx_enter(&c);
+  while (lretire_head && (idle || lretire_head->epoch + 2 <= lepoch_now)) {
+    lretire* r = lretire_head;
+    __atomic_store_n(&lretire_head, r->next, __ATOMIC_RELAXED);
+    if (!lretire_head) { lretire_tail = NULL; }
+    if (r->kind == LRETIRE_MEM) {
+      free(r->p);
+      free(r);
+      continue;
+    }
+
+    /* It may have been linked again, and perhaps unlinked later */
+    unsigned long* queued = r->kind == LRETIRE_VAL
+      ? &((lval*)r->p)->hash : &((lenv*)r->p)->version;
+    int edges = r->kind == LRETIRE_VAL
+      ? ((lval*)r->p)->edges : ((lenv*)r->p)->edges;
+    if (edges > 0) {
+      *queued = 0;
+      free(r);
+    } else if (!idle && *queued + 2 > lepoch_now) {
+      r->epoch = *queued;
+      lretire_push(r);
+    } else {
+      if (r->kind == LRETIRE_VAL) {
+        lval_free_shared(r->p);
+      } else {
+        lenv_free_frame(r->p);
+      }
+      free(r);
+    }
+  }
+  lctx_leave(prev);
+}
+
+/* Reclaims from an evaluator, unless a writer is busy doing it */
+static void lepoch_try_reclaim(void) {
+  if (!__atomic_load_n(&lretire_head, __ATOMIC_RELAXED)) { return; }
+  if (pthread_mutex_trylock(&lshare_lock) != 0) { return; }
+  lepoch_reclaim();
+  pthread_mutex_unlock(&lshare_lock);
+}
+
+/* Global tables are allocated in powers of two, so the capacity of one
+   follows from its count */
+static int lenv_cap(int n) {
+  int cap = 8;
+  while (cap < n) { cap *= 2; }
+  return cap;
+}
+
+/* Readers may be scanning the table. A binding is complete before the
+   count that makes it visible is stored, a full table is copied rather
+   than grown in place, and anything unlinked is retired. */
+static void lenv_bind_shared(lenv* e, char* sym, lval* v) {
+  pthread_mutex_lock(&lshare_lock);
+  e->version++;
+  lval_share(v);
+  for (int i = 0; i < e->count; i++) {
+    if (strcmp(e->syms[i], sym) == 0) {
+      lval* old = e->vals[i];
+      __atomic_store_n(&e->vals[i], v, __ATOMIC_RELEASE);
+      lval_drop(old);
+      lepoch_reclaim();
+      pthread_mutex_unlock(&lshare_lock);
+      return;
+    }
+  }
+  if (e->count == lenv_cap(e->count)) {
+    int cap = lenv_cap(e->count + 1);
+    char** syms = malloc(sizeof(char*) * cap);
+    lval** vals = malloc(sizeof(lval*) * cap);
+    memcpy(syms, e->syms, sizeof(char*) * e->count);
+    memcpy(vals, e->vals, sizeof(lval*) * e->count);
+    char** old_syms = e->syms;
+    lval** old_vals = e->vals;
+    __atomic_store_n(&e->syms, syms, __ATOMIC_RELEASE);
+    __atomic_store_n(&e->vals, vals, __ATOMIC_RELEASE);
+    lepoch_retire(old_syms, LRETIRE_MEM, NULL);
+    lepoch_retire(old_vals, LRETIRE_MEM, NULL);
+  }
+  e->syms[e->count] = malloc(strlen(sym) + 1);
+  strcpy(e->syms[e->count], sym);
+  e->vals[e->count] = v;
+  __atomic_store_n(&e->count, e->count + 1, __ATOMIC_RELEASE);
+  lepoch_reclaim();
+  pthread_mutex_unlock(&lshare_lock);
+}
+
+/* Makes the global env e safe to evaluate against from several threads
+   at once. Fails, changing nothing, if a global cannot be shared. */
+int lenv_share(lenv* e) {
+  if (e->shared) { return 1; }
+  for (int i = 0; i < e->count; i++) {
+    if (lval_unshareable(e->vals[i])) { return 0; }
+  }
+  pthread_mutex_lock(&lshare_lock);
+  e->edges = 1;
+  for (int i = 0; i < e->count; i++) { lval_share(e->vals[i]); }
+  int cap = lenv_cap(e->count);
+  e->syms = realloc(e->syms, sizeof(char*) * cap);
+  e->vals = realloc(e->vals, sizeof(lval*) * cap);
+  e->shared = 1;
+  pthread_mutex_unlock(&lshare_lock);
+  return 1;
+}
+
+/* Every evaluator must be gone */
+static void lenv_free_shared(lenv* e) {
+  pthread_mutex_lock(&lshare_lock);
+  for (int i = 0; i < e->count; i++) {
+    free(e->syms[i]);
+    lval_drop(e->vals[i]);
+  }
+  free(e->syms);
+  free(e->vals);
+  e->count = 0;
+  e->syms = NULL;
+  e->vals = NULL;
+  lenv_drop(e);
+  lepoch_reclaim();
+  pthread_mutex_unlock(&lshare_lock);
+}
+
+void lepoch_init(lepoch* p) {
+  p->epoch = 0;
+  p->joined = 0;
+  p->next = NULL;
+}
+
+/* Registers an evaluator of a shared env */
+void lepoch_join(lepoch* p) {
+  if (p->joined) { return; }
+  pthread_mutex_lock(&lshare_lock);
+  p->next = lepoch_all;
+  lepoch_all = p;
+  p->joined = 1;
+  pthread_mutex_unlock(&lshare_lock);
+}
+
+void lepoch_quit(lepoch* p) {
+  if (!p->joined) { return; }
+  pthread_mutex_lock(&lshare_lock);
+  lepoch** at = &lepoch_all;
+  while (*at != p) { at = &(*at)->next; }
+  *at = p->next;
+  p->joined = 0;
+  lepoch_reclaim();
+  pthread_mutex_unlock(&lshare_lock);
+}
+
+/* Announces the current epoch before anything is read from the env */
+static void lepoch_pin(lepoch* p) {
+  __atomic_store_n(&p->epoch, __atomic_load_n(&lepoch_now, __ATOMIC_SEQ_CST),
+    __ATOMIC_SEQ_CST);
+}
+
+/* Values read from a shared env are not counted, so an evaluation holds
+   them for as long as it runs. Tasks left suspended may still hold some,
+   so their instance stays pinned until they are gone. */
+static int lepoch_holding(void) {
+  return lcur->sched && lsched_busy(lcur->sched);
+}
+
+/* True if v may still refer to something a shared env could retire.
+   Closures over shared frames, sequences, channels and memos are not
+   looked into. */
+static int lval_pins(lval* v) {
+  if (v->refs == LREFS_SHARED) { return 1; }
+  switch (v->type) {
+    case LVAL_STR:
+      return v->strbuf && v->strbuf->refs == LREFS_SHARED;
+    case LVAL_FUN:
+      if (v->fun) { return 0; }
+      if (v->memo || v->env->par) { return 1; }
+      return lval_pins(v->formals) || lval_pins(v->body);
+    case LVAL_SEQ:
+    case LVAL_CHAN:
+      return 1;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      for (int i = 0; i < v->count; i++) {
+        if (lval_pins(v->cell[i])) { return 1; }
+      }
+      return 0;
+    case LVAL_MAP:
+      for (int i = 0; i < v->map->cap; i++) {
+        lmap_entry* e = &v->map->slots[i];
+        if (e->key && (lval_pins(e->key) || lval_pins(e->val))) { return 1; }
+      }
+      return 0;
+    default:
+      return 0;
+  }
+}
+
+/* Copies the parts of v, which the caller owns, that were read from a
+   shared env, so it stays valid after they are retired. What lval_pins
+   does not look into is left as it is. */
+static lval* lval_detach(lval* v) {
+  if (!lval_pins(v)) { return v; }
+  lval* x;
+  switch (v->type) {
+    case LVAL_NUM:
+    case LVAL_ERR:
+    case LVAL_SYM:
+      x = lval_copy(v);
+      break;
+    case LVAL_STR: x = lval_str(v->str, v->len); break;
+    case LVAL_FUN:
+      if (!v->fun) { return v; }
+      x = lval_copy(v);
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      x = lval_own(v);
+      for (int i = 0; i < x->count; i++) {
+        x->cell[i] = lval_detach(x->cell[i]);
+      }
+      return x;
+    case LVAL_MAP:
+      x = lval_own(v);
+      for (int i = 0; i < x->map->cap; i++) {
+        lmap_entry* e = &x->map->slots[i];
+        if (!e->key) { continue; }
+        e->key = lval_detach(e->key);
+        e->val = lval_detach(e->val);
+      }
+      return x;
+    default:
+      return v;
+  }
+  lval_del(v);
+  return x;
+}
+
+/* An evaluation with p in its context is starting */
+void lepoch_begin(lepoch* p) {
+  if (!p->epoch) { lepoch_pin(p); }
+}
+
+/* The evaluation is over; unless tasks still hold values, p holds
+   nothing from the env */
+void lepoch_end(lepoch* p) {
+  if (!lepoch_holding()) {
+    __atomic_store_n(&p->epoch, 0, __ATOMIC_SEQ_CST);
+    lepoch_try_reclaim();
+  }
+}
+
+/* Between top-level forms an evaluator holds nothing from the env */
+static void lepoch_quiesce(void) {
+  lepoch* p = lcur->epoch;
+  if (!p || lepoch_holding()) { return; }
+  lepoch_pin(p);
+  lepoch_try_reclaim();
+}
+
+/**/
+/* LISP Environment Constructors & Functions */
+/**/
+
+lenv* lenv_new(void) {
+  lenv* e = malloc(sizeof(lenv));
+  e->par = NULL;
+  e->refs = 1;
+  e->edges = 0;
+  e->version = 0;
+  e->count = 0;
+  e->shared = 0;
+  e->syms = NULL;
+  e->vals = NULL;
+  e->formals = NULL;
+  return e;
+}
+
+/* Local frame for a call; holds a reference on its parent */
+lenv* lenv_frame(lenv* par, int n) {
+  lenv* e = lenv_new();
+  e->par = lenv_ref(par);
+  e->count = n;
+  e->syms = n ? malloc(sizeof(char*) * n) : NULL;
+  e->vals = n ? malloc(sizeof(lval*) * n) : NULL;
+  return e;
+}
+
+/* Frames are reference counted by the closures that capture them; the
+   global env is not, so closures stored in it form no cycle */
+lenv* lenv_ref(lenv* e) {
+  if (e->par && e->refs != LREFS_SHARED) { e->refs++; }
+  return e;
+}
+
+void lenv_unref(lenv* e) {
+  if (e->par) { lenv_del(e); }
+}
+
+static void lload_note(char* sym, int write);
+
+lval* lenv_get(lenv* e, lval* v) {
+  if (v->slot >= 0) {
+    for (int d = v->depth; d > 0; d--) { e = e->par; }
+    return lval_ref(e->vals[v->slot]);
+  }
+  if (v->slot == LSLOT_GLOBAL) {
+    while (e->par) { e = e->par; }
+  }
+  for (; e; e = e->par) {
+    /* A shared global table may be growing on another thread; the count
+       is loaded first, so every binding below it is complete */
+    int n = __atomic_load_n(&e->count, __ATOMIC_ACQUIRE);
+    char** syms = __atomic_load_n(&e->syms, __ATOMIC_ACQUIRE);
+    lval** vals = __atomic_load_n(&e->vals, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < n; i++) {
+      if (strcmp(syms[i], v->sym) == 0) {
+        if (!e->par) { lload_note(syms[i], 0); }
+        return lval_ref(__atomic_load_n(&vals[i], __ATOMIC_ACQUIRE));
+      }
+    }
+  }
+  lload_note(v->sym, 0);
+  return lval_err("Unbound symbol '%s'", v->sym);
+}
+
+static void lenv_bind_shared(lenv* e, char* sym, lval* v);
+
+/* Binds sym to v, taking ownership of v */
+static void lenv_bind(lenv* e, char* sym, lval* v) {
+  if (!e->par) { lload_note(sym, 1); }
+  if (e->shared) {
+    lenv_bind_shared(e, sym, v);
+    return;
+  }
+  e->version++;
+  for (int i = 0; i < e->count; i++) {
+    if (strcmp(e->syms[i], sym) == 0) {
+      lval_del(e->vals[i]);
+      e->vals[i] = v;
+      return;
+    }
+  }
+  e->count++;
+  e->vals = realloc(e->vals, sizeof(lval*) * e->count);
+  e->syms = realloc(e->syms, sizeof(char*) * e->count);
+
+  e->vals[e->count-1] = v;
+  e->syms[e->count-1] = malloc(strlen(sym)+1);
+  strcpy(e->syms[e->count-1], sym);
+}
+
+void lenv_put(lenv* e, lval* k, lval* v) {
+  lenv_bind(e, k->sym, lval_copy(v));
+}
+
+/* Ownership of v passes to the env */
+void lenv_put_move(lenv* e, lval* k, lval* v) {
+  lenv_bind(e, k->sym, v);
+}
+
+/* Definitions always land in the global env */
+void lenv_def(lenv* e, lval* k, lval* v) {
+  lenv_def_move(e, k, lval_copy(v));
+}
+
+void lenv_def_move(lenv* e, lval* k, lval* v) {
+  while (e->par) { e = e->par; }
+  lenv_bind(e, k->sym, v);
+}
+
+static void lenv_free_shared(lenv* e);
+
+void lenv_del(lenv* e) {
+  if (e->refs == LREFS_SHARED) { return; }
+  if (--e->refs > 0) { return; }
+  if (e->shared) {
+    lenv_free_shared(e);
+    return;
+  }
+  /* Names borrowed from the formals are theirs to free */
+  int borrowed = e->formals ? e->formals->count : 0;
+  for (int i = 0; i < e->count; i++) {
+    if (i >= borrowed) { free(e->syms[i]); }
+    lval_del(e->vals[i]);
+  }
+  if (e->formals) { lval_del(e->formals); }
+  free(e->syms);
+  free(e->vals);
+  if (e->par) { lenv_unref(e->par); }
+  free(e);
+}
+
+void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
+  lenv_bind(e, name, lval_fun(func));
+}
+
+/* Default built-in environment functions */
+void lenv_add_builtins(lenv* e) {
+  lenv_add_builtin(e, "def", builtin_def);
+  lenv_add_builtin(e, "\\", builtin_lambda);
+
+  lenv_add_builtin(e, "list", builtin_list);
+  lenv_add_builtin(e, "len", builtin_len);
+  lenv_add_builtin(e, "head", builtin_head);
+  lenv_add_builtin(e, "init", builtin_init);
+  lenv_add_builtin(e, "tail", builtin_tail);
+  lenv_add_builtin(e, "eval", builtin_eval);
+  lenv_add_builtin(e, "join", builtin_join);
+  lenv_add_builtin(e, "map", builtin_map);
+  lenv_add_builtin(e, "filter", builtin_filter);
+  lenv_add_builtin(e, "foldl", builtin_foldl);
+  lenv_add_builtin(e, "foldr", builtin_foldr);
+  lenv_add_builtin(e, "sort", builtin_sort);
+  lenv_add_builtin(e, "sort-by", builtin_sort_by);
+
+  lenv_add_builtin(e, "range", builtin_range);
+  lenv_add_builtin(e, "take", builtin_take);
+  lenv_add_builtin(e, "drop", builtin_drop);
+  lenv_add_builtin(e, "reduce", builtin_reduce);
+  lenv_add_builtin(e, "collect", builtin_collect);
+
+  lenv_add_builtin(e, "str-len", builtin_str_len);
+  lenv_add_builtin(e, "substr", builtin_substr);
+  lenv_add_builtin(e, "str-join", builtin_str_join);
+  lenv_add_builtin(e, "str-find", builtin_str_find);
+
+  lenv_add_builtin(e, "map-new", builtin_map_new);
+  lenv_add_builtin(e, "map-get", builtin_map_get);
+  lenv_add_builtin(e, "map-put", builtin_map_put);
+  lenv_add_builtin(e, "map-del", builtin_map_del);
+  lenv_add_builtin(e, "map-keys", builtin_map_keys);
+
+  lenv_add_builtin(e, "memo", builtin_memo);
+  lenv_add_builtin(e, "memo-stats", builtin_memo_stats);
+
+  lenv_add_builtin(e, "spawn", builtin_spawn);
+  lenv_add_builtin(e, "yield", builtin_yield);
+  lenv_add_builtin(e, "join-task", builtin_join_task);
+  lenv_add_builtin(e, "chan", builtin_chan);
+  lenv_add_builtin(e, "send", builtin_send);
+  lenv_add_builtin(e, "recv", builtin_recv);
+  lenv_add_builtin(e, "actor-spawn", builtin_actor_spawn);
+
+  lenv_add_builtin(e, "trace", builtin_trace);
+  lenv_add_builtin(e, "trace-dump", builtin_trace_dump);
+
+  lenv_add_builtin(e, "load", builtin_load);
+  lenv_add_builtin(e, "save", builtin_save);
+  lenv_add_builtin(e, "restore", builtin_restore);
+  lenv_add_builtin(e, "restore-seq", builtin_restore_seq);
+  lenv_add_builtin(e, "read-file", builtin_read_file);
+  lenv_add_builtin(e, "read-lines", builtin_read_lines);
+  lenv_add_builtin(e, "read-numbers", builtin_read_numbers);
+  lenv_add_builtin(e, "write-file", builtin_write_file);
+
+  lenv_add_builtin(e, "+", builtin_add);
+  lenv_add_builtin(e, "-", builtin_sub);
+  lenv_add_builtin(e, "*", builtin_mul);
+  lenv_add_builtin(e, "/", builtin_div);
+  lenv_add_builtin(e, "min", builtin_min);
+  lenv_add_builtin(e, "max", builtin_max);
+  lenv_add_builtin(e, "%", builtin_mod);
+  lenv_add_builtin(e, "^", builtin_exp);
+  lenv_add_builtin(e, "<", builtin_lt);
+  lenv_add_builtin(e, ">", builtin_gt);
+  lenv_add_builtin(e, "=", builtin_eq);
+}
+
+
+/**/
+/* LISP Read & Evaluation Functions */
+/**/
+
+/* Read functions */
+lval* lval_read(mpc_ast_t* t) {
+  if (strstr(t->tag, "number")) { return lval_read_num(t); }
+  if (strstr(t->tag, "string")) { return lval_read_str(t); }
+  if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
+
+  lval* x = NULL;
+  if (strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
+  if (strstr(t->tag, "sexpr")) { x = lval_sexpr(); }
+  if (strstr(t->tag, "qexpr")) { x = lval_qexpr(); }
+
+  for (int i = 0; i < t->children_num; i++) {
+    if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
+    if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
+    if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
+    if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
+    if (strcmp(t->children[i]->tag, "regex") == 0) { continue; }
+    x = lval_add(x, lval_read(t->children[i]));
+  }
+  if (lcur->cons && x->type == LVAL_QEXPR) { x = lcons_intern(lcur->cons, x); }
+  return x;
+}
+
+lval* lval_read_num(mpc_ast_t* t) {
+  errno = 0;
+  long x = strtol(t->contents, NULL, 10);
+  return errno != ERANGE ?
+    lval_num(x) : lval_err("Invalid Number.");
+}
+
+/* Unescaped here rather than by mpcf_unescape so the length counts any
+   \0 the string holds */
+lval* lval_read_str(mpc_ast_t* t) {
+  size_t n = strlen(t->contents);
+  char* unescaped = malloc(n);
+  size_t len = 0;
+  for (size_t i = 1; i + 1 < n; i++) {
+    char c = t->contents[i];
+    if (c == '\\' && i + 2 < n) {
+      switch ((c = t->contents[++i])) {
+        case 'a': c = '\a'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'v': c = '\v'; break;
+        case '0': c = '\0'; break;
+        case '\\': case '\'': case '"': break;
+        default: unescaped[len++] = '\\';
+      }
+    }
+    unescaped[len++] = c;
+  }
+  lval* x = lval_str(unescaped, len);
+  free(unescaped);
+  return x;
+}
+
+/* Evaluation function */
+lval* lval_eval(lenv* e, lval* v) {
+  if (v->type == LVAL_SYM) {
+    lval* x = lenv_get(e, v);
+    lval_del(v);
+    return x;
+  }
+  if (v->type == LVAL_SEXPR) {
+#ifdef LJIT
+    long n;
+    if (v->refs != LREFS_SHARED
+        && (v->jit || (v->hot < LJIT_HOT && ++v->hot == LJIT_HOT))
+        && ljit_run(e, v, &n)) {
+      lval_del(v);
+      return lval_num(n);
+    }
+#endif
+    return lval_eval_sexpr(e, v);
+  }
+  return v;
+}
+
+/* S-Expression evaluation function */
+lval* lval_eval_sexpr(lenv* e, lval* v) {
+  if (lcur->sched && lcur->sched->ready.head) { lsched_preempt(); }
+  v = lval_own(v);
+
+  /* The profiler labels a call with the symbol it was made through */
+  lprof* p = v->count > 1 ? lcur->prof : NULL;
+  lval* head = p && v->cell[0]->type == LVAL_SYM ? lval_ref(v->cell[0]) : NULL;
+
+  for (int i = 0; i < v->count; i++) {
+    v->cell[i] = lval_eval(e, v->cell[i]);
+  }
+
+  for (int i = 0; i < v->count; i++) {
+    if (v->cell[i]->type == LVAL_ERR) {
+      if (head) { lval_del(head); }
+      return lval_take(v, i);
+    }
+  }
+
+  if (v->count == 0) { return v; }
+  if (v->count == 1) { return lval_take(v, 0); }
+
+  lval* f = lval_pop(v, 0);
+  if (f->type != LVAL_FUN) {
+    if (head) { lval_del(head); }
+    lval_del(f);
+    lval_del(v);
+    return lval_err("Invalid Symbol.");
+  }
+
+  ltrace* t = lcur->trace && lcur->trace->on ? lcur->trace : NULL;
+  lprof_frame frame;
+  if (p) { lprof_push(p, &frame, head); }
+  if (t) { ltrace_put(t, LTRACE_ENTER, f, v->count); }
+  lval* result = lval_call(e, f, v);
+  if (t) { ltrace_put(t, LTRACE_EXIT, f, result->type); }
+  if (p) { lprof_pop(p, &frame); }
+  lval_del(f);
+
+  return result;
+}
+
+/**/
+/* Built-in Functions */
+/**/
+
+/* Built-in function lookup */
+lval* builtin(lenv* e, lval* v, char* func) {
+  if (strcmp("list", func) == 0) { return builtin_list(e, v); }
+  if (strcmp("head", func) == 0) { return builtin_head(e, v); }
+  if (strcmp("tail", func) == 0) { return builtin_tail(e, v); }
+  if (strcmp("join", func) == 0) { return builtin_join(e, v); }
+  if (strcmp("eval", func) == 0) { return builtin_eval(e, v); }
+  if (strcmp("init", func) == 0) { return builtin_init(e, v); }
+  if (strcmp("len", func) == 0) { return builtin_len(e, v); }
+  if (strstr("+-/*%^minmax", func)) { return builtin_op(e, v, func); }
+
+  lval_del(v);
+  return lval_err("Unknown Function.");
+}
+
+/* Built-in define function */
+lval* builtin_def(lenv* e, lval* v) {
+  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
+    "Function 'def' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+
+  lval* syms = v->cell[0];
+
+  for (int i = 0; i < syms->count; i++) {
+    LASSERT(v, syms->cell[i]->type == LVAL_SYM,
+      "Function 'def' passed invalid symbol '%s'",
+      syms->cell[i]->sym);
+  }
+  LASSERT(v, syms->count == v->count-1,
+    "Function 'def' passed invalid number of arguments.\nGot %i, Expected %i.",
+    syms->count, v->count-1);
+
+  lenv* root = e;
+  while (root->par) { root = root->par; }
+  for (int i = 0; root->shared && i < syms->count; i++) {
+    char* t = lval_unshareable(v->cell[i+1]);
+    LASSERT(v, !t, "Function 'def' cannot share a %s between threads.", t);
+  }
+
+  for (int i = 0; i < syms->count; i++) {
+    lenv_def_move(e, syms->cell[i], lval_steal(v, i+1));
+  }
+
+  lval_del(v);
+  return lval_sexpr();
+}
+
+/* Built-in lambda function */
+lval* builtin_lambda(lenv* e, lval* v) {
+  LASSERT(v, v->count == 2,
+    "Function '\\' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 2);
+  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
+    "Function '\\' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+  LASSERT(v, v->cell[1]->type == LVAL_QEXPR,
+    "Function '\\' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[1]->type), ltype_name(LVAL_QEXPR));
+
+  for (int i = 0; i < v->cell[0]->count; i++) {
+    LASSERT(v, v->cell[0]->cell[i]->type == LVAL_SYM,
+      "Cannot define non-symbol.\nGot %s, Expected %s.",
+      ltype_name(v->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+  }
+
+  lval* formals = lval_pop(v, 0);
+  lval* body = lval_take(v, 0);
+
+  /* Resolution rewrites symbols in place */
+  if (!lval_unique(body)) {
+    lval* x = lval_copy(body);
+    lval_del(body);
+    body = x;
+  }
+  lval_resolve(body, formals, e);
+  return lval_lambda(formals, body, e);
+}
+
+/* Built-in operations */
+int lop_code(char* op) {
+  if (strcmp(op, "+") == 0) { return LOP_ADD; }
+  if (strcmp(op, "-") == 0) { return LOP_SUB; }
+  if (strcmp(op, "*") == 0) { return LOP_MUL; }
+  if (strcmp(op, "/") == 0) { return LOP_DIV; }
+  if (strcmp(op, "%") == 0) { return LOP_MOD; }
+  if (strcmp(op, "^") == 0) { return LOP_EXP; }
+  if (strcmp(op, "min") == 0) { return LOP_MIN; }
+  if (strcmp(op, "max") == 0) { return LOP_MAX; }
+  return LOP_NONE;
+}
+
+/* Applies x = x op y; returns why it cannot, or NULL */
+char* lop_num(int op, long* x, long y) {
+  switch (op) {
+    /* Results past a long are errors, as the compiled code bails on them */
+    case LOP_ADD:
+      if (__builtin_add_overflow(*x, y, x)) { return "Integer overflow."; }
+      break;
+    case LOP_SUB:
+      if (__builtin_sub_overflow(*x, y, x)) { return "Integer overflow."; }
+      break;
+    case LOP_MUL:
+      if (__builtin_mul_overflow(*x, y, x)) { return "Integer overflow."; }
+      break;
+    case LOP_DIV:
+    case LOP_MOD:
+      if (y == 0) { return "Division by zero."; }
+      /* The quotient does not fit, and the CPU traps on it */
+      if (y == -1 && *x == LONG_MIN) { return "Division overflow."; }
+      if (op == LOP_DIV) { *x /= y; } else { *x %= y; }
+      break;
+    case LOP_EXP: {
+      double r = pow(*x, y);
+      if (!(r >= -0x1p63 && r < 0x1p63)) { return "Integer overflow."; }
+      *x = r;
+      break;
+    }
+    case LOP_MIN: *x = *x > y ? y : *x; break;
+    case LOP_MAX: *x = *x > y ? *x : y; break;
+  }
+  return NULL;
+}
+
+lval* builtin_op(lenv* e, lval* v, char* op) {
+  for (int i = 0; i < v->count; i++) {
+    LASSERT(v, v->cell[i]->type == LVAL_NUM,
+      "Function '%s' passed incorrect type for argument %i.\n Got %s, Expected %s.",
+      op, i, ltype_name(v->cell[i]->type), ltype_name(LVAL_NUM));
+  }
+  int code = lop_code(op);
+  lval* x = lval_own(lval_steal(v, 0));
+  if (code == LOP_SUB && v->count == 1) {
+    if (__builtin_sub_overflow(0, x->num, &x->num)) {
+      lval_del(x);
+      x = lval_err("Integer overflow.");
+    }
+  }
+  for (int i = 1; i < v->count && x->type == LVAL_NUM; i++) {
+    char* err = lop_num(code, &x->num, v->cell[i]->num);
+    if (err) {
+      lval_del(x);
+      x = lval_err("%s", err);
+      break;
+    }
+  }
+  lval_del(v);
+  return x;
+}
+
+/* Operator name of an arithmetic builtin, or NULL */
+char* builtin_op_name(lbuiltin f) {
+  if (f == builtin_add) { return "+"; }
+  if (f == builtin_sub) { return "-"; }
+  if (f == builtin_mul) { return "*"; }
+  if (f == builtin_div) { return "/"; }
+  if (f == builtin_mod) { return "%"; }
+  if (f == builtin_exp) { return "^"; }
+  if (f == builtin_min) { return "min"; }
+  if (f == builtin_max) { return "max"; }
+  return NULL;
+}
+
+/* Arithmetic Operations */
+lval* builtin_add(lenv* e, lval* v) {
+  return builtin_op(e, v, "+");
+}
+
+lval* builtin_sub(lenv* e, lval* v) {
+  return builtin_op(e, v, "-");
+}
+
+lval* builtin_mul(lenv* e, lval* v) {
+  return builtin_op(e, v, "*");
+}
+
+lval* builtin_div(lenv* e, lval* v) {
+  return builtin_op(e, v, "/");
+}
+
+lval* builtin_min(lenv* e, lval* v) {
+  return builtin_op(e, v, "min");
+}
+
+lval* builtin_max(lenv* e, lval* v) {
+  return builtin_op(e, v, "max");
+}
+
+lval* builtin_mod(lenv* e, lval* v) {
+  return builtin_op(e, v, "%");
+}
+
+lval* builtin_exp(lenv* e, lval* v) {
+  return builtin_op(e, v, "^");
+}
+
+/* Comparisons follow the order used by sort; = is structural equality */
+static lval* builtin_cmp(lval* v, char* op) {
+  LASSERT(v, v->count == 2,
+    "Function '%s' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    op, v->count, 2);
+  lval* x = v->cell[0];
+  lval* y = v->cell[1];
+  int r;
+  switch (op[0]) {
+    case '<': r = lval_cmp(x, y) < 0; break;
+    case '>': r = lval_cmp(x, y) > 0; break;
+    default: r = lval_eq(x, y); break;
+  }
+  lval_del(v);
+  return lval_num(r);
+}
+
+lval* builtin_lt(lenv* e, lval* v) {
+  return builtin_cmp(v, "<");
+}
+
+lval* builtin_gt(lenv* e, lval* v) {
+  return builtin_cmp(v, ">");
+}
+
+lval* builtin_eq(lenv* e, lval* v) {
+  return builtin_cmp(v, "=");
+}
+
+/* List Operations */
+lval* builtin_list(lenv* e, lval* v) {
+  v->type = LVAL_QEXPR;
+  return v;
+}
+
+lval* builtin_len(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'len' passed too many arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
+    "Function 'len' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+  LASSERT(v, v->cell[0]->count != 0, "Invalid syntax.");
+
+  lval* x = lval_take(v, 0);
+  lval* n = lval_num(x->count);
+  lval_del(x);
+  return n;
+}
+
+lval* builtin_head(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'head' passed too many arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
+    "Function 'head' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+  LASSERT(v, v->cell[0]->count != 0, "Invalid syntax.");
+
+  lval* x = lval_own(lval_take(v, 0));
+  while (x->count > 1) { lval_del(lval_pop(x, x->count-1)); }
+  return x;
+}
+
+lval* builtin_init(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'init' passed too many arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
+    "Function 'init' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+  LASSERT(v, v->cell[0]->count != 0, "Invalid syntax.");
+
+  lval* x = lval_own(lval_take(v, 0));
+  lval_del(lval_pop(x, x->count-1));
+  return x;
+}
+
+lval* builtin_tail(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'tail' passed too many arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
+    "Function 'tail' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+  LASSERT(v, v->cell[0]->count != 0, "Invalid syntax.");
+
+  lval* x = lval_own(lval_take(v, 0));
+  lval_del(lval_pop(x, 0));
+  return x;
+}
+
+lval* builtin_eval(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'eval' passed too many arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
+    "Function 'eval' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+
+  lval* x = lval_own(lval_take(v, 0));
+  x->type = LVAL_SEXPR;
+  return lval_eval(e, x);
+}
+
+lval* builtin_join(lenv* e, lval* v) {
+  for (int i = 0; i < v->count; i++) {
+    LASSERT(v, v->cell[i]->type == LVAL_QEXPR,
+      "Function 'join' passed invalid type.\nGot %s, Expected %s.",
+      ltype_name(v->cell[i]->type), ltype_name(LVAL_QEXPR));
+  }
+
+  lval* x = lval_steal(v, 0);
+  for (int i = 1; i < v->count; i++) { x = lval_join(x, lval_steal(v, i)); }
+
+  lval_del(v);
+  return x;
+}
+
+static lval* builtin_seq_fn(lval* v, int kind);
+
+/* Shared argument checks for map and filter */
+static lval* builtin_fn_list_check(lval* v, char* name) {
+  LASSERT(v, v->count == 2,
+    "Function '%s' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    name, v->count, 2);
+  LASSERT(v, v->cell[0]->type == LVAL_FUN,
+    "Function '%s' passed invalid type.\nGot %s, Expected %s.",
+    name, ltype_name(v->cell[0]->type), ltype_name(LVAL_FUN));
+  LASSERT(v, v->cell[1]->type == LVAL_QEXPR || v->cell[1]->type == LVAL_SEQ,
+    "Function '%s' passed invalid type.\nGot %s, Expected %s.",
+    name, ltype_name(v->cell[1]->type), ltype_name(LVAL_QEXPR));
+  return NULL;
+}
+
+/* A uniquely owned list has its cells overwritten in place */
+lval* builtin_map(lenv* e, lval* v) {
+  lval* err = builtin_fn_list_check(v, "map");
+  if (err) { return err; }
+  if (v->cell[1]->type == LVAL_SEQ) { return builtin_seq_fn(v, LSEQ_MAP); }
+
+  lval* f = lval_pop(v, 0);
+  lval* l = lval_take(v, 0);
+  lval* x = l;
+  if (l->refs > 1) {
+    x = lval_qexpr();
+    x->cell = malloc(sizeof(lval*) * l->count);
+  }
+
+  for (int i = 0; i < l->count; i++) {
+    lval* a = lval_add(lval_sexpr(), x == l ? l->cell[i] : lval_ref(l->cell[i]));
+    lval* r = lval_call(e, f, a);
+    if (r->type == LVAL_ERR) {
+      if (x == l) {
+        /* The consumed cell is refilled so the list can be freed whole */
+        l->cell[i] = lval_sexpr();
+      } else {
+        lval_set_count(x, i);
+        lval_del(x);
+      }
+      lval_del(l);
+      lval_del(f);
+      return r;
+    }
+    x->cell[i] = r;
+  }
+  if (x != l) {
+    lval_set_count(x, l->count);
+    lval_del(l);
+  }
+  lval_del(f);
+  return x;
+}
+
+/* Compacts survivors in one pass; cell is reallocated once */
+lval* builtin_filter(lenv* e, lval* v) {
+  lval* err = builtin_fn_list_check(v, "filter");
+  if (err) { return err; }
+  if (v->cell[1]->type == LVAL_SEQ) { return builtin_seq_fn(v, LSEQ_FILTER); }
+
+  lval* f = lval_pop(v, 0);
+  lval* l = lval_take(v, 0);
+  lval* x = l;
+  if (l->refs > 1) {
+    x = lval_qexpr();
+    x->cell = malloc(sizeof(lval*) * l->count);
+  }
+
+  int k = 0;
+  for (int i = 0; i < l->count; i++) {
+    lval* y = l->cell[i];
+    if (lval_pred(e, f, lval_add(lval_sexpr(), lval_ref(y)), "filter", &err)) {
+      x->cell[k++] = x == l ? y : lval_ref(y);
+    } else if (x == l) {
+      lval_del(y);
+    }
+    if (err) {
+      if (x == l) {
+        for (int j = i+1; j < l->count; j++) { lval_del(l->cell[j]); }
+      } else {
+        lval_del(l);
+      }
+      lval_set_count(x, k);
+      lval_del(x);
+      lval_del(f);
+      return err;
+    }
+  }
+  if (x != l) { lval_del(l); }
+  lval_set_count(x, k);
+  x->cell = realloc(x->cell, sizeof(lval*) * k);
+  lval_del(f);
+  return x;
+}
+
+/* Shared argument checks for the folds */
+static lval* builtin_fold_check(lval* v, char* name) {
+  LASSERT(v, v->count == 3,
+    "Function '%s' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    name, v->count, 3);
+  LASSERT(v, v->cell[0]->type == LVAL_FUN,
+    "Function '%s' passed invalid type.\nGot %s, Expected %s.",
+    name, ltype_name(v->cell[0]->type), ltype_name(LVAL_FUN));
+  LASSERT(v, v->cell[2]->type == LVAL_QEXPR,
+    "Function '%s' passed invalid type.\nGot %s, Expected %s.",
+    name, ltype_name(v->cell[2]->type), ltype_name(LVAL_QEXPR));
+  return NULL;
+}
+
+/* Steps an accumulator; arithmetic builtins on numbers skip the call */
+static lval* lval_fold_step(lenv* e, lval* f, int op, lval* x, lval* y) {
+  if (op != LOP_NONE && x->type == LVAL_NUM && y->type == LVAL_NUM) {
+    x = lval_own(x);
+    char* err = lop_num(op, &x->num, y->num);
+    lval_del(y);
+    if (!err) { return x; }
+    lval_del(x);
+    return lval_err("%s", err);
+  }
+  return lval_call(e, f, lval_add(lval_add(lval_sexpr(), x), y));
+}
+
+/* Elements of a uniquely owned list are moved into each call */
+static lval* builtin_fold(lenv* e, lval* v, int right) {
+  lval* f = lval_pop(v, 0);
+  lval* acc = lval_pop(v, 0);
+  lval* l = lval_take(v, 0);
+  char* name = f->fun ? builtin_op_name(f->fun) : NULL;
+  int op = !right && name ? lop_code(name) : LOP_NONE;
+
+  for (int n = 0; n < l->count; n++) {
+    int i = right ? l->count-1-n : n;
+    lval* y = lval_steal(l, i);
+    acc = right ?
+      lval_call(e, f, lval_add(lval_add(lval_sexpr(), y), acc)) :
+      lval_fold_step(e, f, op, acc, y);
+    if (acc->type == LVAL_ERR) { break; }
+  }
+  lval_del(l);
+  lval_del(f);
+  return acc;
+}
+
+lval* builtin_foldl(lenv* e, lval* v) {
+  lval* err = builtin_fold_check(v, "foldl");
+  return err ? err : builtin_fold(e, v, 0);
+}
+
+lval* builtin_foldr(lenv* e, lval* v) {
+  lval* err = builtin_fold_check(v, "foldr");
+  return err ? err : builtin_fold(e, v, 1);
+}
+
+/* Sorting */
+
+/* Comparator for the merge sort; f NULL means lval_cmp order */
+typedef struct {
+  lenv* e;
+  lval* f;
+  lval* err;
+} lsort;
+
+static int lsort_less(lsort* s, lval* x, lval* y) {
+  if (!s->f) { return lval_cmp(x, y) < 0; }
+  if (s->err) { return 0; }
+  lval* a = lval_add(lval_add(lval_sexpr(), lval_ref(x)), lval_ref(y));
+  return lval_pred(s->e, s->f, a, "sort-by", &s->err);
+}
+
+/* Stable top-down merge sort of n cells; tmp holds at least n/2. Once a
+   comparator fails the order is left unfinished but no cell is lost. */
+static void lsort_merge(lsort* s, lval** cell, lval** tmp, int n) {
+  if (n <= 16) {
+    for (int i = 1; i < n; i++) {
+      lval* x = cell[i];
+      int j = i;
+      for (; j > 0 && lsort_less(s, x, cell[j-1]); j--) { cell[j] = cell[j-1]; }
+      cell[j] = x;
+    }
+    return;
+  }
+  int h = n / 2;
+  lsort_merge(s, cell, tmp, h);
+  lsort_merge(s, cell + h, tmp, n - h);
+  if (!lsort_less(s, cell[h], cell[h-1])) { return; }
+
+  memcpy(tmp, cell, sizeof(lval*) * h);
+  int i = 0, j = h, k = 0;
+  while (i < h && j < n) {
+    cell[k++] = lsort_less(s, cell[j], tmp[i]) ? cell[j++] : tmp[i++];
+  }
+  while (i < h) { cell[k++] = tmp[i++]; }
+}
+
+/* LSD radix sort of numeric cells by their keys, a byte per pass. The
+   sign bit is flipped so keys order as unsigned; passes in which every
+   key has the same byte are skipped. */
+static void lsort_radix(lval** cell, int n) {
+  unsigned long* keys = malloc(sizeof(unsigned long) * n * 2);
+  lval** tmp = malloc(sizeof(lval*) * n);
+  static const int bits = 8;
+  size_t count[sizeof(long)][256];
+  memset(count, 0, sizeof(count));
+  for (int i = 0; i < n; i++) {
+    unsigned long k = (unsigned long)cell[i]->num ^ (1UL << 63);
+    keys[i] = k;
+    for (int b = 0; b < (int)sizeof(long); b++) {
+      count[b][(k >> (b * bits)) & 255]++;
+    }
+  }
+
+  lval** src = cell;
+  lval** dst = tmp;
+  unsigned long* ks = keys;
+  unsigned long* kd = keys + n;
+  for (int b = 0; b < (int)sizeof(long); b++) {
+    int shift = b * bits;
+    size_t* c = count[b];
+    if (c[(ks[0] >> shift) & 255] == (size_t)n) { continue; }
+    size_t sum = 0;
+    for (int d = 0; d < 256; d++) {
+      size_t t = c[d];
+      c[d] = sum;
+      sum += t;
+    }
+    for (int i = 0; i < n; i++) {
+      size_t j = c[(ks[i] >> shift) & 255]++;
+      dst[j] = src[i];
+      kd[j] = ks[i];
+    }
+    lval** p = src; src = dst; dst = p;
+    unsigned long* q = ks; ks = kd; kd = q;
+  }
+  if (src != cell) { memcpy(cell, src, sizeof(lval*) * n); }
+  free(keys);
+  free(tmp);
+}
+
+/* Sorts the cells of a list, in place when it is uniquely owned */
+static lval* lsort_list(lenv* e, lval* f, lval* l) {
+  l = lval_own(l);
+  int numeric = !f && l->count >= LSORT_RADIX;
+  for (int i = 0; numeric && i < l->count; i++) {
+    numeric = l->cell[i]->type == LVAL_NUM;
+  }
+  if (numeric) {
+    lsort_radix(l->cell, l->count);
+    return l;
+  }
+
+  lsort s = { e, f, NULL };
+  lval** tmp = malloc(sizeof(lval*) * (l->count / 2 + 1));
+  lsort_merge(&s, l->cell, tmp, l->count);
+  free(tmp);
+  if (s.err) {
+    lval_del(l);
+    return s.err;
+  }
+  return l;
+}
+
+lval* builtin_sort(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'sort' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
+    "Function 'sort' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+  return lsort_list(e, NULL, lval_take(v, 0));
+}
+
+/* Orders by a less-than predicate, keeping equal elements in order */
+lval* builtin_sort_by(lenv* e, lval* v) {
+  LASSERT(v, v->count == 2,
+    "Function 'sort-by' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 2);
+  LASSERT(v, v->cell[0]->type == LVAL_FUN,
+    "Function 'sort-by' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_FUN));
+  LASSERT(v, v->cell[1]->type == LVAL_QEXPR,
+    "Function 'sort-by' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[1]->type), ltype_name(LVAL_QEXPR));
+  lval* f = lval_pop(v, 0);
+  lval* x = lsort_list(e, f, lval_take(v, 0));
+  lval_del(f);
+  return x;
+}
+
+/* Sequence Operations */
+lval* builtin_range(lenv* e, lval* v) {
+  LASSERT(v, v->count == 2 || v->count == 3,
+    "Function 'range' passed incorrect number of arguments.\nGot %i, Expected %i or %i.",
+    v->count, 2, 3);
+  for (int i = 0; i < v->count; i++) {
+    LASSERT(v, v->cell[i]->type == LVAL_NUM,
+      "Function 'range' passed invalid type.\nGot %s, Expected %s.",
+      ltype_name(v->cell[i]->type), ltype_name(LVAL_NUM));
+  }
+  long step = v->count == 3 ? v->cell[2]->num : 1;
+  LASSERT(v, step != 0, "Function 'range' passed a step of zero.");
+
+  /* Half open: start is included, end is not */
+  lval* x = lval_seq(LSEQ_RANGE, NULL);
+  x->seq->cur = v->cell[0]->num;
+  x->seq->end = v->cell[1]->num;
+  x->seq->step = step;
+  lval_del(v);
+  return x;
+}
+
+/* Shared argument checks for take and drop */
+static lval* builtin_take_drop(lval* v, char* name, int kind) {
+  LASSERT(v, v->count == 2,
+    "Function '%s' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    name, v->count, 2);
+  LASSERT(v, v->cell[0]->type == LVAL_NUM,
+    "Function '%s' passed invalid type.\nGot %s, Expected %s.",
+    name, ltype_name(v->cell[0]->type), ltype_name(LVAL_NUM));
+  LASSERT(v, v->cell[1]->type == LVAL_SEQ || v->cell[1]->type == LVAL_QEXPR,
+    "Function '%s' passed invalid type.\nGot %s, Expected %s.",
+    name, ltype_name(v->cell[1]->type), ltype_name(LVAL_SEQ));
+
+  LASSERT(v, v->cell[0]->num >= 0,
+    "Function '%s' passed a negative count.\nGot %li.",
+    name, v->cell[0]->num);
+
+  long n = v->cell[0]->num;
+  lval* src = lval_take(v, 1);
+
+  /* The dropped cells are freed first, then the rest moved down once */
+  if (src->type == LVAL_QEXPR) {
+    src = lval_own(src);
+    int k = n > src->count ? src->count : (int)n;
+    int from = kind == LSEQ_TAKE ? 0 : k;
+    int keep = kind == LSEQ_TAKE ? k : src->count - k;
+    for (int i = 0; i < from; i++) { lval_del(src->cell[i]); }
+    for (int i = from + keep; i < src->count; i++) { lval_del(src->cell[i]); }
+    memmove(&src->cell[0], &src->cell[from], sizeof(lval*) * keep);
+    lval_set_count(src, keep);
+    src->cell = realloc(src->cell, sizeof(lval*) * keep);
+    return src;
+  }
+
+  lval* x = lval_seq(kind, lval_own(src));
+  x->seq->n = n;
+  return x;
+}
+
+lval* builtin_take(lenv* e, lval* v) {
+  return builtin_take_drop(v, "take", LSEQ_TAKE);
+}
+
+lval* builtin_drop(lenv* e, lval* v) {
+  return builtin_take_drop(v, "drop", LSEQ_DROP);
+}
+
+/* Lazy map and filter over a sequence */
+static lval* builtin_seq_fn(lval* v, int kind) {
+  lval* f = lval_pop(v, 0);
+  lval* x = lval_seq(kind, lval_own(lval_take(v, 0)));
+  x->seq->fn = f;
+  return x;
+}
+
+/* Folds a numeric chunk into acc without boxing; returns why it
+   cannot, or NULL */
+static char* lop_fold(int op, long* acc, long* buf, int n) {
+  long x = *acc;
+  switch (op) {
+    case LOP_ADD:
+      for (int i = 0; i < n; i++) {
+        if (__builtin_add_overflow(x, buf[i], &x)) { return "Integer overflow."; }
+      }
+      break;
+    case LOP_SUB:
+      for (int i = 0; i < n; i++) {
+        if (__builtin_sub_overflow(x, buf[i], &x)) { return "Integer overflow."; }
+      }
+      break;
+    case LOP_MUL:
+      for (int i = 0; i < n; i++) {
+        if (__builtin_mul_overflow(x, buf[i], &x)) { return "Integer overflow."; }
+      }
+      break;
+    case LOP_MIN: for (int i = 0; i < n; i++) { x = x > buf[i] ? buf[i] : x; } break;
+    case LOP_MAX: for (int i = 0; i < n; i++) { x = x > buf[i] ? x : buf[i]; } break;
+    default:
+      for (int i = 0; i < n; i++) {
+        char* err = lop_num(op, &x, buf[i]);
+        if (err) { return err; }
+      }
+  }
+  *acc = x;
+  return NULL;
+}
+
+/* Reduces a list or sequence left to right. Arithmetic builtins over numeric
+   chains run on raw longs, a chunk at a time, in constant memory. */
+lval* builtin_reduce(lenv* e, lval* v) {
+  LASSERT(v, v->count == 2,
+    "Function 'reduce' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 2);
+  LASSERT(v, v->cell[0]->type == LVAL_FUN,
+    "Function 'reduce' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_FUN));
+  LASSERT(v, v->cell[1]->type == LVAL_QEXPR || v->cell[1]->type == LVAL_SEQ,
+    "Function 'reduce' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[1]->type), ltype_name(LVAL_QEXPR));
+  LASSERT(v, v->cell[1]->type == LVAL_SEQ || v->cell[1]->count > 0,
+    "Function 'reduce' passed an empty list.");
+
+  lval* f = lval_pop(v, 0);
+  char* name = f->fun ? builtin_op_name(f->fun) : NULL;
+  int op = name ? lop_code(name) : LOP_NONE;
+  lval* acc = NULL;
+
+  /* A list is a foldl seeded with its first element */
+  if (v->cell[0]->type == LVAL_QEXPR) {
+    lval* l = lval_take(v, 0);
+    acc = lval_steal(l, 0);
+    for (int i = 1; i < l->count && acc->type != LVAL_ERR; i++) {
+      acc = lval_fold_step(e, f, op, acc, lval_steal(l, i));
+    }
+    lval_del(l);
+    lval_del(f);
+    return acc;
+  }
+
+  lval* s = lval_own(lval_take(v, 0));
+
+  /* Chunks live on the heap: reduce may recurse through the function it
+     calls, and the depth limit counts calls, not stack bytes */
+  if (op != LOP_NONE && lseq_numeric(s)) {
+    long* buf = malloc(sizeof(long) * LSEQ_CHUNK);
+    long x = 0;
+    int k = lseq_next_num(s, buf, LSEQ_CHUNK);
+    if (k > 0) {
+      x = buf[0];
+      char* stop = lop_fold(op, &x, buf+1, k-1);
+      while (!stop && !(stop = llimit_poll()) && (k = lseq_next_num(s, buf, LSEQ_CHUNK))) {
+        stop = lop_fold(op, &x, buf, k);
+      }
+      acc = stop ? lval_err("%s", stop) : lval_num(x);
+    }
+    free(buf);
+  } else {
+    lval** buf = malloc(sizeof(lval*) * LSEQ_CHUNK);
+    int k;
+    while ((k = lseq_next(e, s, buf, LSEQ_CHUNK))) {
+      for (int i = 0; i < k; i++) {
+        lval* y = buf[i];
+        if (!acc || acc->type == LVAL_ERR) {
+          if (acc) { lval_del(y); } else { acc = y; }
+          continue;
+        }
+        if (y->type == LVAL_ERR) {
+          lval_del(acc);
+          acc = y;
+        } else if (op != LOP_NONE && acc->type == LVAL_NUM && y->type == LVAL_NUM) {
+          acc = lval_own(acc);
+          char* err = lop_num(op, &acc->num, y->num);
+          if (err) {
+            lval_del(acc);
+            acc = lval_err("%s", err);
+          }
+          lval_del(y);
+        } else {
+          acc = lval_call(e, f, lval_add(lval_add(lval_sexpr(), acc), y));
+        }
+      }
+      char* stop = acc && acc->type == LVAL_ERR ? NULL : llimit_poll();
+      if (stop) {
+        if (acc) { lval_del(acc); }
+        acc = lval_err("%s", stop);
+      }
+      if (acc && acc->type == LVAL_ERR) { break; }
+    }
+    free(buf);
+  }
+
+  lval_del(f);
+  lval_del(s);
+  return acc ? acc : lval_err("Function 'reduce' passed an empty sequence.");
+}
+
+/* Materializes a sequence as a Q-Expression */
+lval* builtin_collect(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'collect' passed too many arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_SEQ,
+    "Function 'collect' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_SEQ));
+
+  lval* s = lval_own(lval_take(v, 0));
+  lval* x = lval_qexpr();
+  lval** buf = malloc(sizeof(lval*) * LSEQ_CHUNK);
+  int k;
+  while ((k = lseq_next(e, s, buf, LSEQ_CHUNK))) {
+    x->cell = realloc(x->cell, sizeof(lval*) * (x->count + k));
+    memcpy(&x->cell[x->count], buf, sizeof(lval*) * k);
+    lval_set_count(x, x->count + k);
+    if (buf[k-1]->type == LVAL_ERR) {
+      lval* err = lval_pop(x, x->count-1);
+      lval_del(x);
+      x = err;
+      break;
+    }
+    char* stop = llimit_poll();
+    if (stop) {
+      lval_del(x);
+      x = lval_err("%s", stop);
+      break;
+    }
+  }
+  free(buf);
+  lval_del(s);
+  return x;
+}
+
+/* String Operations */
+lval* builtin_str_len(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'str-len' passed too many arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_STR,
+    "Function 'str-len' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_STR));
+
+  lval* x = lval_num(v->cell[0]->len);
+  lval_del(v);
+  return x;
+}
+
+/* substr s start [count]; the result shares s's storage */
+lval* builtin_substr(lenv* e, lval* v) {
+  LASSERT(v, v->count == 2 || v->count == 3,
+    "Function 'substr' passed incorrect number of arguments.\nGot %i, Expected %i or %i.",
+    v->count, 2, 3);
+  LASSERT(v, v->cell[0]->type == LVAL_STR,
+    "Function 'substr' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_STR));
+  for (int i = 1; i < v->count; i++) {
+    LASSERT(v, v->cell[i]->type == LVAL_NUM,
+      "Function 'substr' passed invalid type.\nGot %s, Expected %s.",
+      ltype_name(v->cell[i]->type), ltype_name(LVAL_NUM));
+  }
+
+  lval* s = v->cell[0];
+  long start = v->cell[1]->num;
+  LASSERT(v, start >= 0 && (size_t)start <= s->len,
+    "Function 'substr' passed out of range start %li of length %li.",
+    start, (long)s->len);
+  long count = v->count == 3 ? v->cell[2]->num : (long)(s->len - start);
+  LASSERT(v, count >= 0 && (size_t)count <= s->len - start,
+    "Function 'substr' passed out of range slice %li+%li of length %li.",
+    start, count, (long)s->len);
+
+  lval* x = lval_str_slice(s, start, count);
+  lval_del(v);
+  return x;
+}
+
+/* str-join sep {strings}; the result is allocated once */
+lval* builtin_str_join(lenv* e, lval* v) {
+  LASSERT(v, v->count == 2,
+    "Function 'str-join' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 2);
+  LASSERT(v, v->cell[0]->type == LVAL_STR,
+    "Function 'str-join' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_STR));
+  LASSERT(v, v->cell[1]->type == LVAL_QEXPR,
+    "Function 'str-join' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[1]->type), ltype_name(LVAL_QEXPR));
+
+  lval* sep = v->cell[0];
+  lval* l = v->cell[1];
+  size_t total = 0;
+  for (int i = 0; i < l->count; i++) {
+    LASSERT(v, l->cell[i]->type == LVAL_STR,
+      "Function 'str-join' passed invalid element type.\nGot %s, Expected %s.",
+      ltype_name(l->cell[i]->type), ltype_name(LVAL_STR));
+    total += l->cell[i]->len + (i ? sep->len : 0);
+  }
+
+  lval* x = lval_str(NULL, total);
+  char* p = x->str;
+  for (int i = 0; i < l->count; i++) {
+    if (i) {
+      memcpy(p, sep->str, sep->len);
+      p += sep->len;
+    }
+    memcpy(p, l->cell[i]->str, l->cell[i]->len);
+    p += l->cell[i]->len;
+  }
+  lval_del(v);
+  return x;
+}
+
+/* str-find s needle [start]; index of the first match or -1 */
+lval* builtin_str_find(lenv* e, lval* v) {
+  LASSERT(v, v->count == 2 || v->count == 3,
+    "Function 'str-find' passed incorrect number of arguments.\nGot %i, Expected %i or %i.",
+    v->count, 2, 3);
+  for (int i = 0; i < 2; i++) {
+    LASSERT(v, v->cell[i]->type == LVAL_STR,
+      "Function 'str-find' passed invalid type.\nGot %s, Expected %s.",
+      ltype_name(v->cell[i]->type), ltype_name(LVAL_STR));
+  }
+  LASSERT(v, v->count == 2 || v->cell[2]->type == LVAL_NUM,
+    "Function 'str-find' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[v->count-1]->type), ltype_name(LVAL_NUM));
+
+  lval* s = v->cell[0];
+  lval* n = v->cell[1];
+  long start = v->count == 3 ? v->cell[2]->num : 0;
+  long found = -1;
+  if (start < 0) { start = 0; }
+
+  if ((size_t)start <= s->len && n->len <= s->len - start) {
+    if (n->len == 0) {
+      found = start;
+    } else {
+      const char* p = s->str + start;
+      const char* last = s->str + s->len - n->len;
+      while (p <= last && (p = memchr(p, n->str[0], last - p + 1))) {
+        if (memcmp(p, n->str, n->len) == 0) {
+          found = p - s->str;
+          break;
+        }
+        p++;
+      }
+    }
+  }
+  lval_del(v);
+  return lval_num(found);
+}
+
+/* Map Operations */
+static int lmap_key_ok(lval* k) {
+  return k->type == LVAL_NUM || k->type == LVAL_SYM || k->type == LVAL_STR;
+}
+
+/* Symbols evaluate to their bindings, so a symbol key is written {sym};
+   returns the key k stands for */
+static lval* lmap_key(lval* k) {
+  if (k->type == LVAL_QEXPR && k->count == 1 && k->cell[0]->type == LVAL_SYM) {
+    return k->cell[0];
+  }
+  return k;
+}
+
+static lval* lmap_key_arg(lval* v, int i) {
+  lval* k = lmap_key(v->cell[i]);
+  if (k != v->cell[i]) {
+    lval_ref(k);
+    lval_del(v->cell[i]);
+    v->cell[i] = k;
+  }
+  return k;
+}
+
+/* map-new {k v ...}; a builtin cannot be called without arguments, so
+   the pairs come as a Q-Expression. Keys are written as for map-get, a
+   symbol as {sym}. */
+lval* builtin_map_new(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'map-new' passed too many arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
+    "Function 'map-new' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+
+  lval* l = v->cell[0];
+  LASSERT(v, l->count % 2 == 0,
+    "Function 'map-new' passed an odd number of elements.\nGot %i.", l->count);
+  for (int i = 0; i < l->count; i += 2) {
+    LASSERT(v, l->cell[i]->type != LVAL_SYM,
+      "Function 'map-new' passed symbol key '%s'; write it as {%s}.",
+      l->cell[i]->sym, l->cell[i]->sym);
+    LASSERT(v, lmap_key_ok(lmap_key(l->cell[i])),
+      "Function 'map-new' passed invalid key type.\nGot %s, Expected %s, %s or %s.",
+      ltype_name(l->cell[i]->type), ltype_name(LVAL_NUM),
+      ltype_name(LVAL_SYM), ltype_name(LVAL_STR));
+  }
+
+  l = lval_take(v, 0);
+  lval* m = lval_map();
+  for (int i = 0; i < l->count; i += 2) {
+    lval* k = lval_steal(l, i);
+    lval* key = lval_ref(lmap_key(k));
+    lval_del(k);
+    lmap_put(m, key, lval_steal(l, i+1));
+  }
+  lval_del(l);
+  return m;
+}
+
+/* map-get m k [default] */
+lval* builtin_map_get(lenv* e, lval* v) {
+  LASSERT(v, v->count == 2 || v->count == 3,
+    "Function 'map-get' passed incorrect number of arguments.\nGot %i, Expected %i or %i.",
+    v->count, 2, 3);
+  LASSERT(v, v->cell[0]->type == LVAL_MAP,
+    "Function 'map-get' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_MAP));
+
+  lval* x = lmap_get(v->cell[0], lmap_key_arg(v, 1));
+  if (x) {
+    x = lval_ref(x);
+  } else if (v->count == 3) {
+    x = lval_steal(v, 2);
+  } else {
+    char* k = lval_to_string(v->cell[1]);
+    x = lval_err("Key '%s' not found in map.", k);
+    free(k);
+  }
+  lval_del(v);
+  return x;
+}
+
+/* map-put m k v; the map is updated in place when uniquely owned */
+lval* builtin_map_put(lenv* e, lval* v) {
+  LASSERT(v, v->count == 3,
+    "Function 'map-put' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 3);
+  LASSERT(v, v->cell[0]->type == LVAL_MAP,
+    "Function 'map-put' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_MAP));
+  LASSERT(v, lmap_key_ok(lmap_key_arg(v, 1)),
+    "Function 'map-put' passed invalid key type.\nGot %s, Expected %s, %s or %s.",
+    ltype_name(v->cell[1]->type), ltype_name(LVAL_NUM),
+    ltype_name(LVAL_SYM), ltype_name(LVAL_STR));
+
+  lval* m = lval_own(lval_steal(v, 0));
+  lmap_put(m, lval_steal(v, 1), lval_steal(v, 2));
+  lval_del(v);
+  return m;
+}
+
+/* map-del m k */
+lval* builtin_map_del(lenv* e, lval* v) {
+  LASSERT(v, v->count == 2,
+    "Function 'map-del' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 2);
+  LASSERT(v, v->cell[0]->type == LVAL_MAP,
+    "Function 'map-del' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_MAP));
+
+  lval* m = lval_steal(v, 0);
+  if (lmap_get(m, lmap_key_arg(v, 1))) {
+    m = lval_own(m);
+    lmap_del(m, v->cell[1]);
+  }
+  lval_del(v);
+  return m;
+}
+
+lval* builtin_map_keys(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'map-keys' passed too many arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_MAP,
+    "Function 'map-keys' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_MAP));
+
+  lmap* m = v->cell[0]->map;
+  lval* x = lval_qexpr();
+  x->cell = malloc(sizeof(lval*) * m->count);
+  llimit_bytes(m->count * sizeof(lval*));
+  for (int i = 0; i < m->cap; i++) {
+    if (m->slots[i].key) { x->cell[x->count++] = lval_ref(m->slots[i].key); }
+  }
+  lval_del(v);
+  return x;
+}
+
+/* Memoization */
+lval* builtin_memo(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1 || v->count == 3,
+    "Function 'memo' passed incorrect number of arguments.\nGot %i, Expected %i or %i.",
+    v->count, 1, 3);
+  LASSERT(v, v->cell[0]->type == LVAL_FUN,
+    "Function 'memo' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_FUN));
+
+  int max_entries = 1024;
+  size_t max_bytes = 1 << 20;
+  if (v->count == 3) {
+    for (int i = 1; i < 3; i++) {
+      LASSERT(v, v->cell[i]->type == LVAL_NUM && v->cell[i]->num >= 0,
+        "Function 'memo' passed invalid limit for argument %i.", i);
+    }
+    max_entries = v->cell[1]->num > 0x7fffffff ? 0x7fffffff : v->cell[1]->num;
+    max_bytes = v->cell[2]->num;
+  }
+
+  lval* f = lval_pop(v, 0);
+  lval_del(v);
+  return lval_memo(f, max_entries, max_bytes);
+}
+
+lval* builtin_memo_stats(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'memo-stats' passed too many arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_FUN && v->cell[0]->memo,
+    "Function 'memo-stats' passed a function that is not memoized.");
+
+  lmemo* m = v->cell[0]->memo;
+  lval* x = lval_qexpr();
+  lval_add(x, lval_num(m->hits));
+  lval_add(x, lval_num(m->misses));
+  lval_add(x, lval_num(m->count));
+  lval_add(x, lval_num(m->bytes));
+  lval_del(v);
+  return x;
+}
+
+/* Task Operations */
+lval* builtin_spawn(lenv* e, lval* v) {
+  LASSERT(v, v->count >= 1,
+    "Function 'spawn' passed incorrect number of arguments.\nGot %i, Expected at least %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_FUN,
+    "Function 'spawn' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_FUN));
+  LASSERT(v, lcur->sched, "Function 'spawn' needs an interpreter instance.");
+
+  lval* f = lval_pop(v, 0);
+  ltask* t = ltask_new(lcur->sched, f, v);
+  if (!t) {
+    lval_del(f);
+    lval_del(v);
+    return lval_err("Function 'spawn' could not allocate a task stack.");
+  }
+  return lval_num(t->id);
+}
+
+/* Returns its argument once every other ready task has had a turn */
+lval* builtin_yield(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'yield' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  lsched_yield();
+  return lval_take(v, 0);
+}
+
+/* Waits for a task and returns its result; a task can be joined once */
+lval* builtin_join_task(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'join-task' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_NUM,
+    "Function 'join-task' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_NUM));
+
+  lsched* s = lcur->sched;
+  long id = v->cell[0]->num;
+  for (;;) {
+    ltask* t = s && id > 0 && id < s->count ? s->tasks[id] : NULL;
+    LASSERT(v, t, "Function 'join-task' passed unknown task %li.", id);
+    LASSERT(v, t != s->current, "Function 'join-task' passed the running task.");
+    if (t->state == LTASK_DONE) {
+      lval* x = t->result;
+      s->tasks[id] = NULL;
+      free(t);
+      lval_del(v);
+      return x;
+    }
+    LASSERT(v, lsched_block(&t->joiners),
+      "Deadlock: task %li can never finish.", id);
+  }
+}
+
+lval* builtin_chan(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'chan' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_NUM && v->cell[0]->num >= 0
+    && v->cell[0]->num <= 0x7fffffff,
+    "Function 'chan' passed invalid capacity.");
+  int cap = v->cell[0]->num;
+  lval_del(v);
+  return lval_chan(cap);
+}
+
+static char* lmail_unsendable(lval* v);
+static lval* lmail_pack(lval* v);
+
+/* Blocks while a bounded channel is full. Sending to an actor's mailbox
+   hands the value to another thread. */
+lval* builtin_send(lenv* e, lval* v) {
+  LASSERT(v, v->count == 2,
+    "Function 'send' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 2);
+  LASSERT(v, v->cell[0]->type == LVAL_CHAN,
+    "Function 'send' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_CHAN));
+
+  lchan* c = v->cell[0]->chan;
+  if (c->mail) {
+    char* t = lmail_unsendable(v->cell[1]);
+    LASSERT(v, !t, "Function 'send' cannot pass a %s to an actor.", t);
+    char* stop = lmail_put(c->mail, lmail_pack(lval_pop(v, 1)));
+    LASSERT(v, !stop, "%s", stop);
+    lval_del(v);
+    return lval_sexpr();
+  }
+  while (c->cap && c->count >= c->cap) {
+    LASSERT(v, lsched_block(&c->senders),
+      "Deadlock: channel is full and no task can receive.");
+  }
+  if (c->count == c->size) {
+    /* Unwrap the ring into a buffer twice the size */
+    int size = c->size ? c->size * 2 : 8;
+    lval** items = malloc(sizeof(lval*) * size);
+    for (int i = 0; i < c->count; i++) {
+      items[i] = c->items[(c->head + i) % c->size];
+    }
+    free(c->items);
+    c->items = items;
+    c->head = 0;
+    c->size = size;
+  }
+  c->items[(c->head + c->count++) % c->size] = lval_pop(v, 1);
+  lsched_wake(&c->receivers);
+  lval_del(v);
+  return lval_sexpr();
+}
+
+/* Blocks while the channel is empty */
+lval* builtin_recv(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'recv' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_CHAN,
+    "Function 'recv' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_CHAN));
+
+  lchan* c = v->cell[0]->chan;
+  if (c->mail) {
+    char* stop = NULL;
+    lval* x = lmail_get(c->mail, &stop);
+    LASSERT(v, x, "%s", stop);
+    lval_del(v);
+    return x;
+  }
+  while (c->count == 0) {
+    LASSERT(v, lsched_block(&c->receivers),
+      "Deadlock: channel is empty and no task can send.");
+  }
+  lval* x = c->items[c->head];
+  c->head = (c->head + 1) % c->size;
+  c->count--;
+  lsched_wake(&c->senders);
+  lval_del(v);
+  return x;
+}
+
+/* Trace Operations */
+
+/* trace 1 starts recording calls, trace 0 stops */
+lval* builtin_trace(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'trace' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_NUM,
+    "Function 'trace' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_NUM));
+  LASSERT(v, lcur->trace,
+    "Function 'trace' has no trace buffer to record into.");
+  if (v->cell[0]->num) {
+    ltrace_start(lcur->trace, e);
+  } else {
+    lcur->trace->on = 0;
+  }
+  lval_del(v);
+  return lval_sexpr();
+}
+
+lval* builtin_trace_dump(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'trace-dump' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_STR,
+    "Function 'trace-dump' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_STR));
+  LASSERT(v, lcur->trace && lcur->trace->ring,
+    "Function 'trace-dump' found nothing traced.");
+
+  lval* s = v->cell[0];
+  char* path = malloc(s->len + 1);
+  memcpy(path, s->str, s->len);
+  path[s->len] = '\0';
+  int ok = ltrace_dump(lcur->trace, path);
+  free(path);
+  LASSERT(v, ok, "Function 'trace-dump' could not write the trace.");
+  lval_del(v);
+  return lval_sexpr();
+}
+
+/**/
+/* Printing Functions */
+/**/
+
+/* String builder; with an fd it flushes in bounded chunks as it grows */
+void lbuf_init(lbuf* b, int fd) {
+  b->fd = fd;
+  b->len = 0;
+  b->cap = 256;
+  b->data = malloc(b->cap);
+}
+
+void lbuf_flush(lbuf* b) {
+  if (b->fd < 0 || b->len == 0) { return; }
+  fflush(stdout);
+  size_t off = 0;
+  while (off < b->len) {
+    ssize_t n = write(b->fd, b->data + off, b->len - off);
+    if (n < 0) {
+      if (errno == EINTR) { continue; }
+      break;
+    }
+    off += n;
+  }
+  b->len = 0;
+}
+
+static void lbuf_reserve(lbuf* b, size_t n) {
+  if (b->len + n <= b->cap) { return; }
+  if (b->fd >= 0 && b->len > 0) {
+    lbuf_flush(b);
+    if (n <= b->cap) { return; }
+  }
+  while (b->len + n > b->cap) { b->cap *= 2; }
+  b->data = realloc(b->data, b->cap);
+}
+
+void lbuf_put(lbuf* b, const char* s, size_t n) {
+  lbuf_reserve(b, n);
+  memcpy(b->data + b->len, s, n);
+  b->len += n;
+  if (b->fd >= 0 && b->len >= LBUF_FLUSH) { lbuf_flush(b); }
+}
+
+void lbuf_puts(lbuf* b, const char* s) {
+  lbuf_put(b, s, strlen(s));
+}
+
+void lbuf_putc(lbuf* b, char c) {
+  lbuf_put(b, &c, 1);
+}
+
+/* Formats two digits per step from a lookup table */
+void lbuf_num(lbuf* b, long n) {
+  static const char digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+  char tmp[24];
+  char* p = tmp + sizeof(tmp);
+  unsigned long u = n < 0 ? -(unsigned long)n : (unsigned long)n;
+  while (u >= 100) {
+    p -= 2;
+    memcpy(p, &digits[(u % 100) * 2], 2);
+    u /= 100;
+  }
+  if (u >= 10) {
+    p -= 2;
+    memcpy(p, &digits[u * 2], 2);
+  } else {
+    *--p = '0' + u;
+  }
+  if (n < 0) { *--p = '-'; }
+  lbuf_put(b, p, tmp + sizeof(tmp) - p);
+}
+
+/* Quoted and escaped */
+static void lbuf_str(lbuf* b, lval* v) {
+  lbuf_putc(b, '"');
+  size_t run = 0;
+  for (size_t i = 0; i < v->len; i++) {
+    char* esc = NULL;
+    switch (v->str[i]) {
+      case '"': esc = "\\\""; break;
+      case '\\': esc = "\\\\"; break;
+      case '\n': esc = "\\n"; break;
+      case '\t': esc = "\\t"; break;
+      case '\r': esc = "\\r"; break;
+      case '\0': esc = "\\0"; break;
+    }
+    if (esc) {
+      lbuf_put(b, v->str + run, i - run);
+      lbuf_puts(b, esc);
+      run = i + 1;
+    }
+  }
+  lbuf_put(b, v->str + run, v->len - run);
+  lbuf_putc(b, '"');
+}
+
+/* Printed as #{k v k v}; order follows the table */
+static void lbuf_map(lbuf* b, lval* v) {
+  lbuf_puts(b, "#{");
+  int first = 1;
+  for (int i = 0; i < v->map->cap; i++) {
+    lmap_entry* s = &v->map->slots[i];
+    if (!s->key) { continue; }
+    if (!first) { lbuf_putc(b, ' '); }
+    lbuf_lval(b, s->key);
+    lbuf_putc(b, ' ');
+    lbuf_lval(b, s->val);
+    first = 0;
+  }
+  lbuf_putc(b, '}');
+}
+
+static void lbuf_expr(lbuf* b, lval* v, char open, char close) {
+  lbuf_putc(b, open);
+  for (int i = 0; i < v->count; i++) {
+    lbuf_lval(b, v->cell[i]);
+    if (i != (v->count-1)) {
+      lbuf_putc(b, ' ');
+    }
+  }
+  lbuf_putc(b, close);
+}
+
+/* Serializes v in its printed form */
+void lbuf_lval(lbuf* b, lval* v) {
+  switch (v->type) {
+    case LVAL_NUM: lbuf_num(b, v->num); break;
+    case LVAL_ERR: lbuf_puts(b, "Error: "); lbuf_puts(b, v->err); break;
+    case LVAL_SYM: lbuf_puts(b, v->sym); break;
+    case LVAL_STR: lbuf_str(b, v); break;
+    case LVAL_MAP: lbuf_map(b, v); break;
+    case LVAL_SEXPR: lbuf_expr(b, v, '(', ')'); break;
+    case LVAL_QEXPR: lbuf_expr(b, v, '{', '}'); break;
+    case LVAL_SEQ: lbuf_puts(b, "<sequence>"); break;
+    case LVAL_CHAN: lbuf_puts(b, "<channel>"); break;
+    case LVAL_FUN:
+      if (v->memo) {
+        lbuf_puts(b, "(memo ");
+        lbuf_lval(b, v->memo->fn);
+        lbuf_putc(b, ')');
+      } else if (v->fun) {
+        lbuf_puts(b, "<function>");
+      } else {
+        lbuf_puts(b, "(\\ ");
+        lbuf_lval(b, v->formals);
+        lbuf_putc(b, ' ');
+        lbuf_lval(b, v->body);
+        lbuf_putc(b, ')');
+      }
+      break;
+  }
+}
+
+/* Returns a newly allocated string owned by the caller */
+char* lval_to_string(lval* v) {
+  lbuf b;
+  lbuf_init(&b, -1);
+  lbuf_lval(&b, v);
+  lbuf_putc(&b, '\0');
+  return b.data;
+}
+
+void lval_print(lval* v) {
+  lbuf b;
+  lbuf_init(&b, STDOUT_FILENO);
+  lbuf_lval(&b, v);
+  lbuf_flush(&b);
+  free(b.data);
+}
+
+void lval_expr_print(lval* v, char open, char close) {
+  lbuf b;
+  lbuf_init(&b, STDOUT_FILENO);
+  lbuf_expr(&b, v, open, close);
+  lbuf_flush(&b);
+  free(b.data);
+}
+
+/* One write for typical results; huge ones go out LBUF_FLUSH at a time */
+void lval_println(lval* v) {
+  lbuf b;
+  lbuf_init(&b, STDOUT_FILENO);
+  lbuf_lval(&b, v);
+  lbuf_putc(&b, '\n');
+  lbuf_flush(&b);
+  free(b.data);
+}
+
+/**/
+/* Streaming File Reader */
+/**/
+
+int lreader_open(lreader* r, char* path) {
+  r->fd = open(path, O_RDONLY);
+  if (r->fd < 0) { return 0; }
+
+  struct stat st;
+  if (fstat(r->fd, &st) < 0) {
+    close(r->fd);
+    return 0;
+  }
+  r->len = st.st_size;
+  r->pos = 0;
+  r->released = 0;
+  r->data = NULL;
+  if (r->len > 0) {
+    r->data = mmap(NULL, r->len, PROT_READ, MAP_PRIVATE, r->fd, 0);
+    if (r->data == MAP_FAILED) {
+      close(r->fd);
+      return 0;
+    }
+    madvise(r->data, r->len, MADV_SEQUENTIAL);
+  }
+  return 1;
+}
+
+void lreader_close(lreader* r) {
+  if (r->data) { munmap(r->data, r->len); }
+  close(r->fd);
+}
+
+/* Pages already consumed are handed back to keep residency bounded */
+static void lreader_release(lreader* r) {
+  if (r->pos < r->released + LREADER_RELEASE) { return; }
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t upto = r->pos & ~(page - 1);
+  madvise(r->data + r->released, upto - r->released, MADV_DONTNEED);
+  r->released = upto;
+}
+
+/* Next '(' ')' '{' '}' or '"' at or after p, else end. SSE2 tests sixteen
+   bytes per step, so the interior of a large form is skipped quickly. */
+static const char* lreader_delim(const char* p, const char* end) {
+#ifdef __SSE2__
+  const __m128i po = _mm_set1_epi8('(');
+  const __m128i pc = _mm_set1_epi8(')');
+  const __m128i bo = _mm_set1_epi8('{');
+  const __m128i bc = _mm_set1_epi8('}');
+  const __m128i qu = _mm_set1_epi8('"');
+  while (end - p >= 16) {
+    __m128i c = _mm_loadu_si128((const __m128i*)p);
+    __m128i m = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(c, po), _mm_cmpeq_epi8(c, pc)),
+      _mm_or_si128(_mm_cmpeq_epi8(c, bo), _mm_cmpeq_epi8(c, bc)));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(c, qu));
+    int mask = _mm_movemask_epi8(m);
+    if (mask) { return p + __builtin_ctz(mask); }
+    p += 16;
+  }
+#endif
+  for (; p < end; p++) {
+    if (*p == '(' || *p == ')' || *p == '{' || *p == '}' || *p == '"') { return p; }
+  }
+  return end;
+}
+
+/* Just past the string literal opening at p, or end if unterminated */
+static const char* lreader_string(const char* p, const char* end) {
+  for (p++; p < end; p++) {
+    if (*p == '\\') { p++; continue; }
+    if (*p == '"') { return p + 1; }
+  }
+  return end;
+}
+
+static int lreader_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+/* Finds the span of the next top-level form. An unbalanced form runs to
+   the end of the input so the parser can report it. Returns 0 at EOF. */
+int lreader_next(lreader* r, size_t* start, size_t* len) {
+  const char* p = r->data + r->pos;
+  const char* end = r->data + r->len;
+
+  lreader_release(r);
+  while (p < end && lreader_space(*p)) { p++; }
+  if (p == end) {
+    r->pos = r->len;
+    return 0;
+  }
+
+  const char* q = p + 1;
+  if (*p == '(' || *p == '{') {
+    int depth = 1;
+    while (depth > 0) {
+      q = lreader_delim(q, end);
+      if (q == end) { break; }
+      if (*q == '"') {
+        q = lreader_string(q, end);
+        continue;
+      }
+      depth += (*q == '(' || *q == '{') ? 1 : -1;
+      q++;
+    }
+  } else if (*p == '"') {
+    q = lreader_string(p, end);
+  } else if (*p != ')' && *p != '}') {
+    while (q < end && !lreader_space(*q) && *q != '"' &&
+      *q != '(' && *q != ')' && *q != '{' && *q != '}') { q++; }
+  }
+
+  *start = p - r->data;
+  *len = q - p;
+  r->pos = q - r->data;
+  return 1;
+}
+
+/* Zero based row and column of a byte offset; only used for errors */
+void lreader_locate(lreader* r, size_t off, long* row, long* col) {
+  *row = 0;
+  *col = 0;
+  const char* p = r->data;
+  const char* end = r->data + off;
+  const char* nl;
+  while ((nl = memchr(p, '\n', end - p))) {
+    (*row)++;
+    p = nl + 1;
+  }
+  *col = end - p;
+}
+
+/* Parses the form at start..start+len of r; NULL if it does not parse */
+static lval* lreader_read(lreader* r, mpc_parser_t* p, char* path,
+  size_t start, size_t len, char** buf, size_t* cap) {
+  if (len + 1 > *cap) {
+    *cap = len + 1;
+    *buf = realloc(*buf, *cap);
+  }
+  memcpy(*buf, r->data + start, len);
+  (*buf)[len] = '\0';
+
+  mpc_result_t res;
+  lreclaim* paused = lreclaim_pause();
+  int ok = mpc_parse(path, *buf, p, &res);
+  lreclaim_resume(paused);
+  if (!ok) {
+    /* Report the position within the file, not the form */
+    long row, col;
+    lreader_locate(r, start, &row, &col);
+    if (res.error->state.row == 0) { res.error->state.col += col; }
+    res.error->state.row += row;
+    mpc_err_print(res.error);
+    mpc_err_delete(res.error);
+    return NULL;
+  }
+  lval* x = lval_read(res.output);
+  mpc_ast_delete(res.output);
+  return x;
+}
+
+/* Parses and evaluates the form spanning len bytes at start, through a
+   scratch buffer grown as needed. A parse error is printed with its
+   position in the file, and NULL returned. */
+static lval* lreader_eval(lreader* r, lenv* e, mpc_parser_t* p, char* path,
+  size_t start, size_t len, char** buf, size_t* cap) {
+  lval* x = lreader_read(r, p, path, start, len, buf, cap);
+  return x ? lval_eval(e, x) : NULL;
+}
+
+/* Reads, evaluates and prints one top-level form at a time, so memory is
+   bounded by the largest form rather than the file. */
+int lval_eval_file(lenv* e, mpc_parser_t* p, char* path) {
+  lreader r;
+  if (!lreader_open(&r, path)) { return 0; }
+
+  char* buf = NULL;
+  size_t cap = 0;
+  size_t start, len;
+  while (!llimit_cancelled() && lreader_next(&r, &start, &len)) {
+    /* Each form gets the full budget */
+    llimit_reset();
+    ltime_begin(path, r.data + start, len);
+    lval* x = lreader_read(&r, p, path, start, len, &buf, &cap);
+    ltime_lap(LTIME_READ);
+    if (x) {
+      x = lval_eval(e, x);
+      ltime_lap(LTIME_EVAL);
+      lval_println(x);
+      lval_del(x);
+      ltime_lap(LTIME_PRINT);
+    }
+    ltime_end();
+    lepoch_quiesce();
+  }
+
+  free(buf);
+  lreader_close(&r);
+  return 1;
+}
+
+/**/
+/* Parallel Reader */
+/**/
+
+static void* lread_work(void* arg) {
+  lread_job* j = arg;
+  char* buf = NULL;
+  size_t cap = 0;
+  for (int i = j->from; i < j->to; i++) {
+    size_t start = j->spans[2*i];
+    size_t len = j->spans[2*i+1];
+    if (len + 1 > cap) {
+      cap = len + 1;
+      buf = realloc(buf, cap);
+    }
+    memcpy(buf, j->r->data + start, len);
+    buf[len] = '\0';
+
+    /* Allocations are counted here and charged when the form runs */
+    llimit count;
+    memset(&count, 0, sizeof(count));
+    lctx c = lctx_none;
+    c.limit = &count;
+    lctx* prev = lctx_enter(&c);
+    mpc_result_t res;
+    j->forms[i] = NULL;
+    j->errs[i] = NULL;
+    uint64_t t = ltime_now();
+    if (mpc_parse(j->path, buf, j->parser, &res)) {
+      j->forms[i] = lval_read(res.output);
+      mpc_ast_delete(res.output);
+    } else {
+      j->errs[i] = res.error;
+    }
+    j->reads[i] = ltime_now() - t;
+    j->bytes[i] = count.bytes;
+    lctx_leave(prev);
+  }
+  free(buf);
+  return NULL;
+}
+
+/* As lval_eval_file, but the forms of each window are split by size
+   across threads and parsed in parallel. Evaluation stays on the calling
+   thread, in file order. */
+int lval_eval_file_parallel(lenv* e, mpc_parser_t* p, char* path, int threads) {
+  lreader r;
+  if (!lreader_open(&r, path)) { return 0; }
+
+  int cap = 1024;
+  size_t* spans = malloc(sizeof(size_t) * 2 * cap);
+  lval** forms = malloc(sizeof(lval*) * cap);
+  long* bytes = malloc(sizeof(long) * cap);
+  uint64_t* reads = malloc(sizeof(uint64_t) * cap);
+  mpc_err_t** errs = malloc(sizeof(mpc_err_t*) * cap);
+  lread_job* jobs = malloc(sizeof(lread_job) * threads);
+  pthread_t* tids = malloc(sizeof(pthread_t) * threads);
+  int* started = malloc(sizeof(int) * threads);
+
+  size_t start, len;
+  int more = lreader_next(&r, &start, &len);
+  while (more) {
+    /* Gather a window of whole forms */
+    int n = 0;
+    size_t total = 0;
+    while (more && (n == 0 || total < LREAD_WINDOW)) {
+      if (n == cap) {
+        cap *= 2;
+        spans = realloc(spans, sizeof(size_t) * 2 * cap);
+        forms = realloc(forms, sizeof(lval*) * cap);
+        bytes = realloc(bytes, sizeof(long) * cap);
+        reads = realloc(reads, sizeof(uint64_t) * cap);
+        errs = realloc(errs, sizeof(mpc_err_t*) * cap);
+      }
+      spans[2*n] = start;
+      spans[2*n+1] = len;
+      total += len;
+      n++;
+      more = lreader_next(&r, &start, &len);
+    }
+
+    /* Consecutive runs of forms of about equal size per thread */
+    int used = 0;
+    int from = 0;
+    size_t done = 0;
+    for (int t = 0; t < threads && from < n; t++) {
+      size_t goal = total / threads * (t + 1);
+      int to = from + 1;
+      done += spans[2*from+1];
+      while (to < n && (done < goal || t == threads - 1)) {
+        done += spans[2*to+1];
+        to++;
+      }
+      lread_job* j = &jobs[used++];
+      j->parser = p;
+      j->path = path;
+      j->r = &r;
+      j->spans = spans;
+      j->from = from;
+      j->to = to;
+      j->forms = forms;
+      j->bytes = bytes;
+      j->reads = reads;
+      j->errs = errs;
+      from = to;
+    }
+    /* A job whose thread cannot start is parsed here instead */
+    for (int t = 1; t < used; t++) {
+      started[t] = pthread_create(&tids[t], NULL, lread_work, &jobs[t]) == 0;
+    }
+    lread_work(&jobs[0]);
+    for (int t = 1; t < used; t++) {
+      if (started[t]) { pthread_join(tids[t], NULL); } else { lread_work(&jobs[t]); }
+    }
+
+    for (int i = 0; i < n; i++) {
+      /* A cancel stops the file; the rest of the window is dropped */
+      if (llimit_cancelled()) {
+        if (errs[i]) { mpc_err_delete(errs[i]); } else { lval_del(forms[i]); }
+        more = 0;
+        continue;
+      }
+      ltime_begin(path, r.data + spans[2*i], spans[2*i+1]);
+      ltime_phase(LTIME_READ, reads[i]);
+      if (errs[i]) {
+        /* Report the position within the file, not the form */
+        long row, col;
+        lreader_locate(&r, spans[2*i], &row, &col);
+        if (errs[i]->state.row == 0) { errs[i]->state.col += col; }
+        errs[i]->state.row += row;
+        mpc_err_print(errs[i]);
+        mpc_err_delete(errs[i]);
+        ltime_end();
+        continue;
+      }
+      /* Each form gets the full budget */
+      llimit_reset();
+      llimit_bytes(bytes[i]);
+      lval* x = lval_eval(e, forms[i]);
+      ltime_lap(LTIME_EVAL);
+      lval_println(x);
+      lval_del(x);
+      ltime_lap(LTIME_PRINT);
+      ltime_end();
+      lepoch_quiesce();
+    }
+  }
+
+  free(spans);
+  free(forms);
+  free(bytes);
+  free(reads);
+  free(errs);
+  free(jobs);
+  free(tids);
+  free(started);
+  lreader_close(&r);
+  return 1;
+}
+
+/**/
+/* Incremental Loading */
+/**/
+
+/* Whether a load is noting the globals the current form reads */
+static int lload_recording(void) {
+  return lcur->load && lcur->load->form;
+}
+
+void lload_init(lload* l, mpc_parser_t* parser) {
+  l->parser = parser;
+  l->files = NULL;
+  l->form = NULL;
+  l->last = NULL;
+}
+
+static void lload_form_free(lload_form* f) {
+  for (int i = 0; i < f->nreads; i++) { free(f->reads[i]); }
+  for (int i = 0; i < f->nwrites; i++) { free(f->writes[i]); }
+  free(f->reads);
+  free(f->writes);
+}
+
+void lload_free(lload* l) {
+  while (l->files) {
+    lload_file* f = l->files;
+    l->files = f->next;
+    for (int i = 0; i < f->count; i++) { lload_form_free(&f->forms[i]); }
+    free(f->forms);
+    free(f->path);
+    free(f);
+  }
+}
+
+static char* lload_has(char** set, int n, char* sym) {
+  for (int i = 0; i < n; i++) {
+    if (strcmp(set[i], sym) == 0) { return set[i]; }
+  }
+  return NULL;
+}
+
+/* Adds a copy of sym to a set of names; returns the set's copy */
+static char* lload_add(char*** set, int* n, char* sym) {
+  char* s = lload_has(*set, *n, sym);
+  if (s) { return s; }
+  *set = realloc(*set, sizeof(char*) * (*n + 1));
+  s = (*set)[*n] = malloc(strlen(sym) + 1);
+  strcpy(s, sym);
+  (*n)++;
+  return s;
+}
+
+/* Called for every global lookup and definition; records it against the
+   form being loaded, if any. Loops read the same name over and over, so
+   the last name read is checked first. */
+static void lload_note(char* sym, int write) {
+  if (!lload_recording()) { return; }
+  lload* l = lcur->load;
+  lload_form* f = l->form;
+  if (write) {
+    lload_add(&f->writes, &f->nwrites, sym);
+    return;
+  }
+  if (l->last && strcmp(l->last, sym) == 0) { return; }
+  l->last = lload_add(&f->reads, &f->nreads, sym);
+}
+
+static int lload_touches(lload_form* f, char** set, int n) {
+  for (int i = 0; i < n; i++) {
+    if (lload_has(f->reads, f->nreads, set[i])) { return 1; }
+    if (lload_has(f->writes, f->nwrites, set[i])) { return 1; }
+  }
+  return 0;
+}
+
+static int lload_cmp(const void* a, const void* b) {
+  const lload_form* x = *(lload_form* const*)a;
+  const lload_form* y = *(lload_form* const*)b;
+  if (x->hash != y->hash) { return x->hash < y->hash ? -1 : 1; }
+  return x < y ? -1 : x > y;
+}
+
+/* Loads path, evaluating only what its last load makes stale. Each form
+   is matched by the hash of its text against the forms of the previous
+   load. A form is evaluated again if it is new, or if it read or defined
+   a name that an evaluated or deleted form defines. Returns how many
+   forms were evaluated, -1 if the file cannot be read, or -2 if it is
+   already being loaded. */
+long lload_run(lload* l, lenv* e, char* path) {
+  lload_file* file = l->files;
+  while (file && strcmp(file->path, path) != 0) { file = file->next; }
+  if (file && file->busy) { return -2; }
+
+  lreader r;
+  if (!lreader_open(&r, path)) { return -1; }
+  if (!file) {
+    file = calloc(1, sizeof(lload_file));
+    file->path = malloc(strlen(path) + 1);
+    strcpy(file->path, path);
+    file->next = l->files;
+    l->files = file;
+  }
+
+  /* Old forms sorted by hash, equal texts in file order */
+  lload_form** old = malloc(sizeof(lload_form*) * (file->count + 1));
+  char* used = calloc(file->count + 1, 1);
+  for (int i = 0; i < file->count; i++) { old[i] = &file->forms[i]; }
+  qsort(old, file->count, sizeof(lload_form*), lload_cmp);
+  file->busy = 1;
+
+  int count = 0;
+  int cap = 0;
+  lload_form* forms = NULL;
+  int* match = NULL;
+  size_t start, len;
+  while (lreader_next(&r, &start, &len)) {
+    if (count == cap) {
+      cap = cap ? cap * 2 : 64;
+      forms = realloc(forms, sizeof(lload_form) * cap);
+      match = realloc(match, sizeof(int) * cap);
+    }
+    lload_form* f = &forms[count];
+    memset(f, 0, sizeof(lload_form));
+    f->hash = lhash_bytes(14695981039346656037UL, r.data + start, len);
+    f->start = start;
+    f->len = len;
+
+    int lo = 0, hi = file->count;
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      if (old[mid]->hash < f->hash) { lo = mid + 1; } else { hi = mid; }
+    }
+    while (lo < file->count && old[lo]->hash == f->hash && used[lo]) { lo++; }
+    match[count] = -1;
+    if (lo < file->count && old[lo]->hash == f->hash) {
+      used[lo] = 1;
+      match[count] = lo;
+    }
+    count++;
+  }
+
+  /* Names defined by deleted forms are stale */
+  char** stale = NULL;
+  int nstale = 0;
+  for (int i = 0; i < file->count; i++) {
+    if (used[i]) { continue; }
+    for (int j = 0; j < old[i]->nwrites; j++) {
+      lload_add(&stale, &nstale, old[i]->writes[j]);
+    }
+    lload_form_free(old[i]);
+  }
+
+  long ran = 0;
+  char* buf = NULL;
+  size_t bufcap = 0;
+  lload_form* outer = l->form;
+  for (int i = 0; i < count; i++) {
+    lload_form* f = &forms[i];
+    lload_form* o = match[i] >= 0 ? old[match[i]] : NULL;
+    if (o && !lload_touches(o, stale, nstale)) {
+      f->reads = o->reads;
+      f->nreads = o->nreads;
+      f->writes = o->writes;
+      f->nwrites = o->nwrites;
+      continue;
+    }
+    if (o) {
+      for (int j = 0; j < o->nwrites; j++) {
+        lload_add(&stale, &nstale, o->writes[j]);
+      }
+      lload_form_free(o);
+    }
+
+    l->form = f;
+    l->last = NULL;
+    lval* x = lreader_eval(&r, e, l->parser, path, f->start, f->len, &buf, &bufcap);
+    l->form = outer;
+    l->last = NULL;
+    if (x && x->type == LVAL_ERR) { lval_println(x); }
+    if (x) { lval_del(x); }
+    for (int j = 0; j < f->nwrites; j++) {
+      lload_add(&stale, &nstale, f->writes[j]);
+    }
+    ran++;
+  }
+
+  for (int i = 0; i < nstale; i++) { free(stale[i]); }
+  free(stale);
+  free(buf);
+  free(match);
+  free(used);
+  free(old);
+  free(file->forms);
+  file->forms = forms;
+  file->count = count;
+  file->busy = 0;
+  lreader_close(&r);
+  return ran;
+}
+
+/* load "path" evaluates a file, printing any errors. Loading it again
+   evaluates only the forms an edit affects; returns how many ran. */
+lval* builtin_load(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'load' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_STR,
+    "Function 'load' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_STR));
+  LASSERT(v, lcur->load, "Function 'load' has no parser to read with.");
+
+  lval* s = v->cell[0];
+  char* path = malloc(s->len + 1);
+  memcpy(path, s->str, s->len);
+  path[s->len] = '\0';
+  long ran = lload_run(lcur->load, e, path);
+  lval* x = ran >= 0 ? lval_num(ran)
+    : ran == -1 ? lval_err("Could not load file '%s'", path)
+    : lval_err("File '%s' is already being loaded", path);
+  free(path);
+  lval_del(v);
+  return x;
+}
+
+/**/
+/* Binary Values */
+/**/
+
+static size_t lbin_varint(lbuf* b, unsigned long n) {
+  char tmp[10];
+  int i = 0;
+  while (n >= 0x80) {
+    tmp[i++] = (char)(n | 0x80);
+    n >>= 7;
+  }
+  tmp[i++] = (char)n;
+  lbuf_put(b, tmp, i);
+  return i;
+}
+
+static size_t lbin_bytes(lbuf* b, int tag, const char* s, size_t len) {
+  lbuf_putc(b, tag);
+  size_t n = lbin_varint(b, len);
+  lbuf_put(b, s, len);
+  return 1 + n + len;
+}
+
+/* Functions, sequences and channels have no saved form */
+static char* lbin_unsavable(lval* v, int depth) {
+  switch (v->type) {
+    case LVAL_FUN:
+    case LVAL_SEQ:
+    case LVAL_CHAN:
+      return ltype_name(v->type);
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (depth >= LBIN_DEPTH) { return "deeply nested list"; }
+      for (int i = 0; i < v->count; i++) {
+        char* t = lbin_unsavable(v->cell[i], depth + 1);
+        if (t) { return t; }
+      }
+      return NULL;
+    case LVAL_MAP:
+      for (int i = 0; i < v->map->cap; i++) {
+        lmap_entry* s = &v->map->slots[i];
+        if (!s->key) { continue; }
+        char* t = lbin_unsavable(s->val, depth + 1);
+        if (t) { return t; }
+      }
+      return NULL;
+  }
+  return NULL;
+}
+
+/* Returns how many bytes were written */
+static size_t lbin_put(lbuf* b, lval* v) {
+  size_t n = 1;
+  switch (v->type) {
+    case LVAL_NUM:
+      lbuf_putc(b, LBIN_NUM);
+      return 1 + lbin_varint(b, ((unsigned long)v->num << 1)
+        ^ (unsigned long)(v->num >> (sizeof(long) * 8 - 1)));
+    case LVAL_ERR: return lbin_bytes(b, LBIN_ERR, v->err, strlen(v->err));
+    case LVAL_SYM: return lbin_bytes(b, LBIN_SYM, v->sym, strlen(v->sym));
+    case LVAL_STR: return lbin_bytes(b, LBIN_STR, v->str, v->len);
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      lbuf_putc(b, v->type == LVAL_SEXPR ? LBIN_SEXPR : LBIN_QEXPR);
+      n += lbin_varint(b, v->count);
+      for (int i = 0; i < v->count; i++) { n += lbin_put(b, v->cell[i]); }
+      return n;
+    case LVAL_MAP:
+      lbuf_putc(b, LBIN_MAP);
+      n += lbin_varint(b, v->map->count);
+      for (int i = 0; i < v->map->cap; i++) {
+        lmap_entry* s = &v->map->slots[i];
+        if (!s->key) { continue; }
+        n += lbin_put(b, s->key);
+        n += lbin_put(b, s->val);
+      }
+      return n;
+  }
+  return 0;
+}
+
+/* Writes v, which must have passed lbin_unsavable, to path. Returns 0 if
+   the file could not be written in full. */
+int lbin_save(lval* v, char* path) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) { return 0; }
+  lbuf b;
+  lbuf_init(&b, fd);
+  lbuf_put(&b, LBIN_MAGIC, sizeof(LBIN_MAGIC) - 1);
+  lbuf_putc(&b, LBIN_VERSION);
+  /* The magic and version byte take sizeof(LBIN_MAGIC) bytes */
+  size_t total = sizeof(LBIN_MAGIC) + lbin_put(&b, v);
+  lbuf_flush(&b);
+  free(b.data);
+
+  /* lbuf drops what it cannot write, so the size tells if it all went */
+  struct stat st;
+  int ok = fstat(fd, &st) == 0 && (size_t)st.st_size == total;
+  close(fd);
+  return ok;
+}
+
+/* Reads a varint at *p; returns 0 if it runs past end or overflows */
+static int lbin_uint(const unsigned char** p, const unsigned char* end,
+  unsigned long* out) {
+  unsigned long n = 0;
+  for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+    unsigned char c = *(*p)++;
+    n |= (unsigned long)(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      *out = n;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Varint count or length at *p, if that many bytes could follow it */
+static int lbin_len(const unsigned char** p, const unsigned char* end,
+  unsigned long* out) {
+  return lbin_uint(p, end, out) && *out <= (unsigned long)(end - *p);
+}
+
+/* Decodes the value at *p and moves past it; NULL if the bytes are not a
+   well formed value */
+static lval* lbin_get(const unsigned char** p, const unsigned char* end,
+  int depth) {
+  unsigned long n;
+  if (*p == end) { return NULL; }
+  int tag = *(*p)++;
+  switch (tag) {
+    case LBIN_NUM:
+      if (!lbin_uint(p, end, &n)) { return NULL; }
+      return lval_num((long)(n >> 1) ^ -(long)(n & 1));
+
+    case LBIN_ERR:
+    case LBIN_SYM:
+    case LBIN_STR: {
+      if (!lbin_len(p, end, &n)) { return NULL; }
+      const char* s = (const char*)*p;
+      *p += n;
+      if (tag == LBIN_STR) { return lval_str(s, n); }
+      if (tag == LBIN_ERR) { return lval_err("%.*s", (int)n, s); }
+      lval* x = lval_alloc();
+      x->type = LVAL_SYM;
+      x->refs = 1;
+      x->sym = malloc(n + 1);
+      memcpy(x->sym, s, n);
+      x->sym[n] = '\0';
+      x->depth = 0;
+      x->slot = LSLOT_NONE;
+      return x;
+    }
+
+    case LBIN_SEXPR:
+    case LBIN_QEXPR: {
+      if (depth >= LBIN_DEPTH || !lbin_len(p, end, &n)) { return NULL; }
+      lval* x = tag == LBIN_SEXPR ? lval_sexpr() : lval_qexpr();
+      x->cell = malloc(sizeof(lval*) * n);
+      for (unsigned long i = 0; i < n; i++) {
+        lval* y = lbin_get(p, end, depth + 1);
+        if (!y) {
+          lval_del(x);
+          return NULL;
+        }
+        lval_set_count(x, i + 1);
+        x->cell[i] = y;
+      }
+      if (lcur->cons && x->type == LVAL_QEXPR) { x = lcons_intern(lcur->cons, x); }
+      return x;
+    }
+
+    case LBIN_MAP: {
+      if (depth >= LBIN_DEPTH || !lbin_len(p, end, &n)) { return NULL; }
+      lval* m = lval_map();
+      for (unsigned long i = 0; i < n; i++) {
+        lval* k = lbin_get(p, end, depth + 1);
+        lval* v = k ? lbin_get(p, end, depth + 1) : NULL;
+        if (!v || !lmap_key_ok(k)) {
+          if (k) { lval_del(k); }
+          if (v) { lval_del(v); }
+          lval_del(m);
+          return NULL;
+        }
+        lmap_put(m, k, v);
+      }
+      return m;
+    }
+  }
+  return NULL;
+}
+
+/* Opens path if it holds a saved value; sets *why and returns 0 if it is
+   a saved value that cannot be read, or 0 with *why NULL if it is not
+   one at all */
+static int lbin_open(lreader* r, char* path, char** why) {
+  *why = NULL;
+  if (!lreader_open(r, path)) { return 0; }
+  size_t n = sizeof(LBIN_MAGIC) - 1;
+  if (r->len < n + 1 || memcmp(r->data, LBIN_MAGIC, n) != 0) {
+    lreader_close(r);
+    return 0;
+  }
+  if (r->data[n] != LBIN_VERSION) {
+    *why = "was saved in an unknown format version";
+    lreader_close(r);
+    return 0;
+  }
+  r->pos = n + 1;
+  return 1;
+}
+
+/* The value saved in path, an error if it is unreadable, or NULL if path
+   does not hold a saved value */
+lval* lbin_load(char* path) {
+  lreader r;
+  char* why;
+  if (!lbin_open(&r, path, &why)) {
+    return why ? lval_err("File '%s' %s.", path, why) : NULL;
+  }
+  const unsigned char* p = (const unsigned char*)r.data + r.pos;
+  const unsigned char* end = (const unsigned char*)r.data + r.len;
+  lval* x = lbin_get(&p, end, 0);
+  if (x && p != end) {
+    lval_del(x);
+    x = NULL;
+  }
+  lreader_close(&r);
+  return x ? x : lval_err("File '%s' is corrupt.", path);
+}
+
+/* A sequence decoding the elements of the list saved in path as they are
+   pulled, so only the elements in use are ever in memory */
+lval* lbin_seq(char* path) {
+  lreader r;
+  char* why;
+  if (!lbin_open(&r, path, &why)) {
+    return lval_err("File '%s' %s.", path, why ? why : "does not hold a saved value");
+  }
+  const unsigned char* p = (const unsigned char*)r.data + r.pos;
+  const unsigned char* end = (const unsigned char*)r.data + r.len;
+  unsigned long n;
+  int list = p < end && (*p == LBIN_SEXPR || *p == LBIN_QEXPR);
+  p++;
+  if (!list || !lbin_len(&p, end, &n)) {
+    lreader_close(&r);
+    return lval_err("File '%s' does not hold a saved list.", path);
+  }
+  lval* x = lval_seq(LSEQ_FILE, NULL);
+  x->seq->bin = malloc(sizeof(lbin));
+  x->seq->bin->refs = 1;
+  x->seq->bin->r = r;
+  x->seq->cur = p - (const unsigned char*)r.data;
+  x->seq->n = n;
+  return x;
+}
+
+static char* lbin_path(lval* s) {
+  char* path = malloc(s->len + 1);
+  memcpy(path, s->str, s->len);
+  path[s->len] = '\0';
+  return path;
+}
+
+/* save "path" value writes value in the binary format */
+lval* builtin_save(lenv* e, lval* v) {
+  LASSERT(v, v->count == 2,
+    "Function 'save' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 2);
+  LASSERT(v, v->cell[0]->type == LVAL_STR,
+    "Function 'save' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_STR));
+  char* t = lbin_unsavable(v->cell[1], 0);
+  LASSERT(v, !t, "Function 'save' cannot save a %s.", t);
+
+  char* path = lbin_path(v->cell[0]);
+  int ok = lbin_save(v->cell[1], path);
+  lval* x = ok ? lval_sexpr() : lval_err("Could not write file '%s'", path);
+  free(path);
+  lval_del(v);
+  return x;
+}
+
+/* restore "path" is the value saved in path */
+lval* builtin_restore(lenv* e, lval* v) {
   LASSERT(v, v->count == 1,
-    "Function 'len' passed too many arguments.\nGot %i, Expected %i.",
+    "Function 'restore' passed incorrect number of arguments.\nGot %i, Expected %i.",
     v->count, 1);
-  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
-    "Function 'len' passed invalid type.\nGot %s, Expected %s.",
-    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
-  LASSERT(v, v->cell[0]->count != 0, "Invalid syntax.");
+  LASSERT(v, v->cell[0]->type == LVAL_STR,
+    "Function 'restore' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_STR));
 
-  lval* x = lval_take(v, 0);
-  return lval_num(x->count);
+  char* path = lbin_path(v->cell[0]);
+  lval* x = lbin_load(path);
+  if (!x) { x = lval_err("File '%s' does not hold a saved value.", path); }
+  free(path);
+  lval_del(v);
+  return x;
 }
 
-lval* builtin_head(lenv* e, lval* v) {
+/* restore-seq "path" is a lazy sequence of the list saved in path */
+lval* builtin_restore_seq(lenv* e, lval* v) {
   LASSERT(v, v->count == 1,
-    "Function 'head' passed too many arguments.\nGot %i, Expected %i.",
+    "Function 'restore-seq' passed incorrect number of arguments.\nGot %i, Expected %i.",
     v->count, 1);
-  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
-    "Function 'head' passed invalid type.\nGot %s, Expected %s.",
-    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
-  LASSERT(v, v->cell[0]->count != 0, "Invalid syntax.");
+  LASSERT(v, v->cell[0]->type == LVAL_STR,
+    "Function 'restore-seq' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_STR));
 
-  lval* x = lval_take(v, 0);
-  while (x->count > 1) { lval_del(lval_pop(x, 1)); }
+  char* path = lbin_path(v->cell[0]);
+  lval* x = lbin_seq(path);
+  free(path);
+  lval_del(v);
   return x;
 }
 
-lval* builtin_init(lenv* e, lval* v) {
-  LASSERT(v, v->count == 1,
-    "Function 'init' passed too many arguments.\nGot %i, Expected %i.",
-    v->count, 1);
-  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
-    "Function 'init' passed invalid type.\nGot %s, Expected %s.",
-    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
-  LASSERT(v, v->cell[0]->count != 0, "Invalid syntax.");
+/**/
+/* File Operations */
+/**/
 
-  lval* x = lval_take(v, 0);
-  lval_del(lval_pop(x, x->count-1));
+/* The whole of path as a string, or NULL. A regular file is read in one
+   call straight into the string; anything else until it ends. */
+static lval* lfile_read(char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) { return NULL; }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+
+  lval* x = NULL;
+  if (S_ISREG(st.st_mode)) {
+    x = lval_str(NULL, st.st_size);
+    size_t n = 0;
+    while (n < x->len) {
+      ssize_t k = read(fd, x->str + n, x->len - n);
+      if (k < 0 && errno == EINTR) { continue; }
+      if (k <= 0) { break; }
+      n += k;
+    }
+    /* The file shrank while being read */
+    x->len = n;
+  } else {
+    size_t len = 0, cap = LBUF_FLUSH;
+    char* buf = malloc(cap);
+    while (buf) {
+      if (len == cap) { buf = realloc(buf, cap *= 2); }
+      ssize_t k = read(fd, buf + len, cap - len);
+      if (k < 0 && errno == EINTR) { continue; }
+      if (k < 0) {
+        free(buf);
+        buf = NULL;
+      }
+      if (k <= 0) { break; }
+      len += k;
+    }
+    if (buf) { x = lval_str(buf, len); }
+    free(buf);
+  }
+  close(fd);
   return x;
 }
 
-lval* builtin_tail(lenv* e, lval* v) {
-  LASSERT(v, v->count == 1,
-    "Function 'tail' passed too many arguments.\nGot %i, Expected %i.",
-    v->count, 1);
-  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
-    "Function 'tail' passed invalid type.\nGot %s, Expected %s.",
-    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
-  LASSERT(v, v->cell[0]->count != 0, "Invalid syntax.");
+static int lfile_write(char* path, const char* s, size_t n) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) { return 0; }
+  while (n > 0) {
+    ssize_t k = write(fd, s, n);
+    if (k < 0 && errno == EINTR) { continue; }
+    if (k <= 0) { break; }
+    s += k;
+    n -= k;
+  }
+  int ok = n == 0;
+  if (close(fd) != 0) { ok = 0; }
+  return ok;
+}
 
-  lval* x = lval_take(v, 0);
-  lval_del(lval_pop(x, 0));
-  return x;
+/* First byte in p..end that is a digit, or with digit 0 is not one.
+   SSE2 tests sixteen bytes per step. */
+static const char* lnum_scan(const char* p, const char* end, int digit) {
+#ifdef __SSE2__
+  const __m128i zero = _mm_set1_epi8('0');
+  const __m128i nine = _mm_set1_epi8(9);
+  while (end - p >= 16) {
+    __m128i d = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)p), zero);
+    int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, nine), d));
+    if (!digit) { m = ~m & 0xffff; }
+    if (m) { return p + __builtin_ctz(m); }
+    p += 16;
+  }
+#endif
+  while (p < end && ((unsigned char)(*p - '0') <= 9) != digit) { p++; }
+  return p;
 }
 
-lval* builtin_eval(lenv* e, lval* v) {
-  LASSERT(v, v->count == 1,
-    "Function 'eval' passed too many arguments.\nGot %i, Expected %i.",
-    v->count, 1);
-  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
-    "Function 'eval' passed invalid type.\nGot %s, Expected %s.",
-    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/* The k <= 8 digits ending at end, from one 8 byte load and three
+   multiplies instead of a multiply per digit */
+static unsigned long lnum_digits8(const char* end, size_t k) {
+  uint64_t v;
+  memcpy(&v, end - 8, 8);
+  v &= ~0ULL << (8 * (8 - k));
+  v = (v & 0x0F0F0F0F0F0F0F0FULL) * 2561 >> 8;
+  v = (v & 0x00FF00FF00FF00FFULL) * 6553601 >> 16;
+  return (uint32_t)((v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL >> 32);
+}
+#endif
 
-  lval* x = lval_take(v, 0);
-  x->type = LVAL_SEXPR;
-  return lval_eval(e, x);
+/* The digits p..q, negative if a '-' comes just before them; returns 0
+   if the value does not fit in a long */
+static int lnum_parse(const char* begin, const char* p, const char* q,
+  long* out) {
+  int neg = p > begin && p[-1] == '-';
+  size_t k = q - p;
+  unsigned long u = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  /* Sixteen digits always fit; the loads must stay inside the file */
+  if (k <= 16 && q - begin >= 16) {
+    u = k > 8
+      ? lnum_digits8(q - 8, k - 8) * 100000000UL + lnum_digits8(q, 8)
+      : lnum_digits8(q, k);
+    *out = neg ? -(long)u : (long)u;
+    return 1;
+  }
+#endif
+  unsigned long limit = neg ? (unsigned long)LONG_MAX + 1 : LONG_MAX;
+  for (; p < q; p++) {
+    unsigned long d = *p - '0';
+    if (u > (limit - d) / 10) { return 0; }
+    u = u * 10 + d;
+  }
+  *out = neg ? (long)(0UL - u) : (long)u;
+  return 1;
 }
 
-lval* builtin_join(lenv* e, lval* v) {
-  for (int i = 0; i < v->count; i++) {
-    LASSERT(v, v->cell[i]->type == LVAL_QEXPR,
-      "Function 'join' passed invalid type.\nGot %s, Expected %s.",
-      ltype_name(v->cell[i]->type), ltype_name(LVAL_QEXPR));
+/* A numeric sequence of the integers in path, parsed up front into one
+   array grown as they are read. Runs of digits are numbers, negative after a '-', and anything
+   else separates them. */
+lval* lnums_seq(char* path) {
+  lreader r;
+  if (!lreader_open(&r, path)) {
+    return lval_err("Could not read file '%s'", path);
   }
+  long cap = 64;
+  long* data = malloc(sizeof(long) * cap);
+  long n = 0;
+  if (r.len > 0) {
+    const char* p = r.data;
+    const char* end = r.data + r.len;
+    while ((p = lnum_scan(p, end, 1)) < end) {
+      const char* q = lnum_scan(p, end, 0);
+      if (n == cap) {
+        cap *= 2;
+        data = realloc(data, sizeof(long) * cap);
+      }
+      if (!lnum_parse(r.data, p, q, &data[n])) {
+        free(data);
+        lreader_close(&r);
+        return lval_err("File '%s' holds a number too large to read.", path);
+      }
+      n++;
+      p = q;
+      r.pos = q - r.data;
+      lreader_release(&r);
+    }
+  }
+  lreader_close(&r);
 
-  lval* x = lval_pop(v, 0);
-  while (v->count) { x = lval_join(x, lval_pop(v, 0)); }
+  llimit_bytes(sizeof(long) * n);
+  lval* x = lval_seq(LSEQ_NUMS, NULL);
+  x->seq->nums = malloc(sizeof(lnums));
+  x->seq->nums->refs = 1;
+  x->seq->nums->count = n;
+  x->seq->nums->data = realloc(data, sizeof(long) * (n ? n : 1));
+  x->seq->end = n;
+  return x;
+}
+
+/* read-file "path" is the contents of path as a string */
+lval* builtin_read_file(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'read-file' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_STR,
+    "Function 'read-file' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_STR));
 
+  char* path = lbin_path(v->cell[0]);
+  lval* x = lfile_read(path);
+  if (!x) { x = lval_err("Could not read file '%s'", path); }
+  free(path);
   lval_del(v);
   return x;
 }
 
-/**/
-/* Printing Functions */
-/**/
+/* read-lines "path" is a Q-Expression of the lines of path, without
+   their line endings. Long lines share the file's storage. */
+lval* builtin_read_lines(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'read-lines' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_STR,
+    "Function 'read-lines' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_STR));
 
-void lval_print(lval* v) {
-  switch (v->type) {
-    case LVAL_NUM: printf("%li", v->num); break;
-    case LVAL_ERR: printf("Error: %s", v->err); break;
-    case LVAL_SYM: printf("%s", v->sym); break;
-    case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
-    case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
-    case LVAL_FUN: printf("<function>"); break;
+  char* path = lbin_path(v->cell[0]);
+  lval* s = lfile_read(path);
+  if (!s) {
+    lval* err = lval_err("Could not read file '%s'", path);
+    free(path);
+    lval_del(v);
+    return err;
   }
-}
+  free(path);
+  lval_del(v);
 
-void lval_expr_print(lval* v, char open, char close) {
-  putchar(open);
-  for (int i = 0; i < v->count; i++) {
-    lval_print(v->cell[i]);
-    if (i != (v->count-1)) {
-      putchar(' ');
-    }
+  const char* begin = s->str;
+  const char* end = s->str + s->len;
+  int count = 0;
+  for (const char* p = begin; p < end; count++) {
+    const char* nl = memchr(p, '\n', end - p);
+    p = nl ? nl + 1 : end;
+  }
+  lval* x = lval_qexpr();
+  x->cell = malloc(sizeof(lval*) * count);
+  lval_set_count(x, count);
+  const char* p = begin;
+  for (int i = 0; i < count; i++) {
+    const char* nl = memchr(p, '\n', end - p);
+    const char* stop = nl ? nl : end;
+    if (stop > p && stop[-1] == '\r') { stop--; }
+    x->cell[i] = lval_str_slice(s, p - begin, stop - p);
+    p = nl ? nl + 1 : end;
   }
-  putchar(close);
+  lval_del(s);
+  return x;
 }
 
-void lval_println(lval* v) {
-  lval_print(v);
-  putchar('\n');
+/* read-numbers "path" is a numeric sequence of the integers in path;
+   reduce runs over it without boxing, and collect makes it a list */
+lval* builtin_read_numbers(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'read-numbers' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_STR,
+    "Function 'read-numbers' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_STR));
+
+  char* path = lbin_path(v->cell[0]);
+  lval* x = lnums_seq(path);
+  free(path);
+  lval_del(v);
+  return x;
+}
+
+/* write-file "path" value writes a string's bytes as they are, and any
+   other value as it prints */
+lval* builtin_write_file(lenv* e, lval* v) {
+  LASSERT(v, v->count == 2,
+    "Function 'write-file' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 2);
+  LASSERT(v, v->cell[0]->type == LVAL_STR,
+    "Function 'write-file' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_STR));
+
+  char* path = lbin_path(v->cell[0]);
+  lval* y = v->cell[1];
+  char* text = y->type == LVAL_STR ? NULL : lval_to_string(y);
+  int ok = text ? lfile_write(path, text, strlen(text))
+    : lfile_write(path, y->str, y->len);
+  lval* x = ok ? lval_sexpr() : lval_err("Could not write file '%s'", path);
+  free(text);
+  free(path);
+  lval_del(v);
+  return x;
 }
 
 /**/
-/* Main */
+/* Interpreter Instances */
 /**/
 
-int main(int argc, char** argv) {
+/* Everything an interpreter needs lives here, so instances are
+   independent and each may be driven from its own thread */
+struct mylisp {
+  mpc_parser_t* Number;
+  mpc_parser_t* Symbol;
+  mpc_parser_t* String;
+  mpc_parser_t* Sexpr;
+  mpc_parser_t* Qexpr;
+  mpc_parser_t* Expr;
+  mpc_parser_t* MyLisp;
+  lenv* env;
+  llimit limit;
+  lsched sched;
+  lcons cons;
+  int hashcons;
+  ltrace trace;
+  lprof prof;
+  lload load;
+  int readers;
+  lepoch epoch;
+  int attached;
+  lreclaim reclaim;
+  ltime time;
+  lactors actors;
+  lctx ctx;
+};
+
+/* An instance evaluating against env */
+static mylisp* mylisp_make(lenv* env) {
+  mylisp* m = malloc(sizeof(mylisp));
 
   /* Parser and grammar definitions */
-  mpc_parser_t* Number = mpc_new("number");
-  mpc_parser_t* Symbol = mpc_new("symbol");
-  mpc_parser_t* Sexpr = mpc_new("sexpr");
-  mpc_parser_t* Qexpr = mpc_new("qexpr");
-  mpc_parser_t* Expr = mpc_new("expr");
-  mpc_parser_t* MyLisp =  mpc_new("mylisp");
+  m->Number = mpc_new("number");
+  m->Symbol = mpc_new("symbol");
+  m->String = mpc_new("string");
+  m->Sexpr = mpc_new("sexpr");
+  m->Qexpr = mpc_new("qexpr");
+  m->Expr = mpc_new("expr");
+  m->MyLisp =  mpc_new("mylisp");
 
   mpca_lang(MPCA_LANG_DEFAULT,
     "                                                   \
       number : /-?[0-9]+/ ;                             \
       symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!%^&]+/ ;     \
+      string : /\"(\\\\.|[^\"])*\"/ ;                  \
       sexpr  : '(' <expr>* ')' ;                        \
       qexpr  : '{' <expr>* '}' ;                        \
-      expr   : <number> | <symbol> | <sexpr> | <qexpr> ;\
+      expr   : <number> | <symbol> | <string>           \
+             | <sexpr> | <qexpr> ;                      \
       mylisp : /^/ <expr>* /$/ | ;                      \
     ",
-    Number, Symbol, Sexpr, Qexpr, Expr, MyLisp);
+    m->Number, m->Symbol, m->String, m->Sexpr, m->Qexpr, m->Expr, m->MyLisp);
+
+  m->env = env;
+  m->limit.max_steps = 0;
+  m->limit.max_bytes = 0;
+  m->limit.max_ms = 0;
+  m->limit.cancel = 0;
+  lsched_init(&m->sched, m->env);
+  lcons_init(&m->cons);
+  m->hashcons = 0;
+  ltrace_init(&m->trace);
+  lprof_init(&m->prof);
+  lload_init(&m->load, m->MyLisp);
+  m->readers = 1;
+  lepoch_init(&m->epoch);
+  m->attached = 0;
+  lreclaim_init(&m->reclaim);
+  ltime_init(&m->time);
+  lactors_init(&m->actors);
+  return m;
+}
+
+/* Makes m's state the context of this thread's evaluation, taking its
+   reclaimer's lock; returns the previous context */
+static lctx* mylisp_enter(mylisp* m) {
+  lctx* c = &m->ctx;
+  c->limit = &m->limit;
+  c->reclaim = &m->reclaim;
+  c->sched = &m->sched;
+  c->cons = m->hashcons ? &m->cons : NULL;
+  c->trace = &m->trace;
+  c->prof = m->prof.path ? &m->prof : NULL;
+  c->time = m->time.on ? &m->time : NULL;
+  c->load = &m->load;
+  c->epoch = m->env->shared ? &m->epoch : NULL;
+  c->actors = &m->actors;
+  lctx* prev = lctx_enter(c);
+  if (prev->reclaim != c->reclaim) { lreclaim_lock(c->reclaim); }
+  llimit_start(c->limit);
+  if (c->epoch) { lepoch_begin(c->epoch); }
+  return prev;
+}
 
-  puts("MyLisp Version 0.0.5");
-  puts("Press Ctrl+c to Exit\n");
+static void mylisp_leave(mylisp* m, lctx* prev) {
+  lctx* c = &m->ctx;
+  if (c->epoch) { lepoch_end(c->epoch); }
+  if (prev->reclaim != c->reclaim) { lreclaim_unlock(c->reclaim); }
+  lctx_leave(prev);
+}
 
+mylisp* mylisp_new(void) {
   lenv* e = lenv_new();
   lenv_add_builtins(e);
+  return mylisp_make(e);
+}
 
-  while (1) {
-    char* input = readline("MyLisp> ");
-    add_history(input);
+/* A new instance evaluating against m's global env, so each sees what
+   the other defines; the two may run on different threads. Fails if a
+   global of m cannot be shared. m must be freed last. */
+mylisp* mylisp_attach(mylisp* m) {
+  lctx* prev = mylisp_enter(m);
+  int ok = lenv_share(m->env);
+  mylisp_leave(m, prev);
+  if (!ok) { return NULL; }
+  lepoch_join(&m->epoch);
+  mylisp* x = mylisp_make(m->env);
+  x->attached = 1;
+  lepoch_join(&x->epoch);
+  return x;
+}
 
-    mpc_result_t r;
-    if (mpc_parse("<stdin>", input, MyLisp, &r)) {
-      lval* x = lval_eval(e, lval_read(r.output));
-      // mpc_ast_print(r.output);
-      lval_println(x);
+/* Evaluates every form in src; returns the printed result, or the parse
+   error, as a string the caller must free */
+char* mylisp_eval_string(mylisp* m, const char* src) {
+  __atomic_store_n(&m->limit.cancel, 0, __ATOMIC_RELAXED);
+  lctx* prev = mylisp_enter(m);
+  ltime_begin("<stdin>", src, strlen(src));
+  mpc_result_t r;
+  lreclaim* paused = lreclaim_pause();
+  int parsed = mpc_parse("<stdin>", src, m->MyLisp, &r);
+  lreclaim_resume(paused);
+  if (!parsed) {
+    char* err = mpc_err_string(r.error);
+    mpc_err_delete(r.error);
+    size_t n = strlen(err);
+    if (n && err[n-1] == '\n') { err[n-1] = '\0'; }
+    ltime_lap(LTIME_READ);
+    ltime_end();
+    mylisp_leave(m, prev);
+    return err;
+  }
+  /* Parsing is not charged to the budget */
+  llimit_reset();
+  lval* x = lval_read(r.output);
+  ltime_lap(LTIME_READ);
+  x = lval_eval(m->env, x);
+  ltime_lap(LTIME_EVAL);
+  char* out = lval_to_string(x);
+  lval_del(x);
+  ltime_lap(LTIME_PRINT);
+  mpc_ast_delete(r.output);
+  ltime_end();
+  mylisp_leave(m, prev);
+  return out;
+}
+
+/* Evaluates a file form by form, printing each result */
+int mylisp_eval_file(mylisp* m, char* path) {
+  __atomic_store_n(&m->limit.cancel, 0, __ATOMIC_RELAXED);
+  lctx* prev = mylisp_enter(m);
+  int ok = m->readers > 1
+    ? lval_eval_file_parallel(m->env, m->MyLisp, path, m->readers)
+    : lval_eval_file(m->env, m->MyLisp, path);
+  mylisp_leave(m, prev);
+  return ok;
+}
+
+/* Limits apply to each evaluation separately; zero means unlimited */
+void mylisp_limit(mylisp* m, long steps, long bytes, long ms) {
+  m->limit.max_steps = steps;
+  m->limit.max_bytes = bytes;
+  m->limit.max_ms = ms;
+}
+
+/* Stops the running evaluation with an error, and the rest of a file
+   being evaluated. Only sets a flag, so it is safe to call from a signal
+   handler or another thread; the next mylisp_eval_* call clears it. */
+void mylisp_cancel(mylisp* m) {
+  __atomic_store_n(&m->limit.cancel, 1, __ATOMIC_RELAXED);
+}
+
+/* With hash-consing on, equal Q-Expression literals read afterwards share
+   one immutable node */
+void mylisp_hashcons(mylisp* m, int on) {
+  m->hashcons = on;
+}
+
+/* Records builtin and lambda calls into a ring of the last LTRACE_SIZE
+   events; switching is a flag, so it is cheap to leave the ring around */
+void mylisp_trace(mylisp* m, int on) {
+  if (on) {
+    lctx* prev = mylisp_enter(m);
+    ltrace_start(&m->trace, m->env);
+    mylisp_leave(m, prev);
+  } else {
+    m->trace.on = 0;
+  }
+}
+
+/* Safe to call from a signal handler on the evaluating thread */
+int mylisp_trace_dump(mylisp* m, const char* path) {
+  return ltrace_dump(&m->trace, path);
+}
+
+/* Samples Lisp call stacks hz times per second of CPU time, writing them
+   to path as folded stacks when the instance is freed. The timer is per
+   process, so this fails while another instance is profiling, and CPU
+   time of other threads is sampled too. */
+int mylisp_profile(mylisp* m, int hz, const char* path) {
+  return lprof_start(&m->prof, hz, path);
+}
+
+/* Times the read, eval and print of each top-level form. When the
+   instance is freed, p50/p90/p99/max of each go to stderr, and the top
+   slowest forms with their source to csv, if given. */
+int mylisp_time(mylisp* m, int top, const char* csv) {
+  return ltime_start(&m->time, top, csv);
+}
+
+/* Files are parsed on n threads; 1 parses on the evaluating thread */
+void mylisp_readers(mylisp* m, int n) {
+  m->readers = n > 1 ? n : 1;
+}
+
+void mylisp_free(mylisp* m) {
+  lprof_stop(&m->prof);
+  ltime_stop(&m->time);
+  lactors_free(&m->actors);
+  lctx* prev = mylisp_enter(m);
+  lsched_free(&m->sched);
+  mylisp_leave(m, prev);
+  lreclaim_free(&m->reclaim);
+  lepoch_quit(&m->epoch);
+  if (!m->attached) { lenv_del(m->env); }
+  lcons_free(&m->cons);
+  ltrace_free(&m->trace);
+  lload_free(&m->load);
+  mpc_cleanup(7, m->Number, m->Symbol, m->String, m->Sexpr, m->Qexpr,
+    m->Expr, m->MyLisp);
+  free(m);
+}
+
+/**/
+/* Actors */
+/**/
+
+lmail* lmail_new(void) {
+  lmail* b = calloc(1, sizeof(lmail));
+  b->refs = 1;
+  b->mask = LMAIL_CAP - 1;
+  b->cells = malloc(sizeof(lmail_cell) * LMAIL_CAP);
+  for (size_t i = 0; i < LMAIL_CAP; i++) { b->cells[i].seq = i; }
+  pthread_mutex_init(&b->lock, NULL);
+  pthread_cond_init(&b->changed, NULL);
+  return b;
+}
+
+lmail* lmail_ref(lmail* b) {
+  __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+  return b;
+}
+
+/* Claims the cell at head for x; returns 0 if the mailbox is full */
+static int lmail_offer(lmail* b, lval* x) {
+  size_t pos = __atomic_load_n(&b->head, __ATOMIC_RELAXED);
+  for (;;) {
+    lmail_cell* c = &b->cells[pos & b->mask];
+    size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+    long d = (long)(seq - pos);
+    if (d == 0) {
+      if (__atomic_compare_exchange_n(&b->head, &pos, pos + 1, 1,
+          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        c->val = x;
+        __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+        return 1;
+      }
+    } else if (d < 0) {
+      return 0;
+    } else {
+      pos = __atomic_load_n(&b->head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/* Claims the message at tail; returns NULL if the mailbox is empty */
+static lval* lmail_take(lmail* b) {
+  size_t pos = __atomic_load_n(&b->tail, __ATOMIC_RELAXED);
+  for (;;) {
+    lmail_cell* c = &b->cells[pos & b->mask];
+    size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+    long d = (long)(seq - (pos + 1));
+    if (d == 0) {
+      if (__atomic_compare_exchange_n(&b->tail, &pos, pos + 1, 1,
+          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        lval* x = c->val;
+        __atomic_store_n(&c->seq, pos + b->mask + 1, __ATOMIC_RELEASE);
+        return x;
+      }
+    } else if (d < 0) {
+      return NULL;
+    } else {
+      pos = __atomic_load_n(&b->tail, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/* Whether a receiver (get) or a sender could now get on with b */
+static int lmail_ready(lmail* b, int get) {
+  if (__atomic_load_n(&b->closed, __ATOMIC_SEQ_CST)) { return 1; }
+  size_t pos = __atomic_load_n(get ? &b->tail : &b->head, __ATOMIC_SEQ_CST);
+  size_t seq = __atomic_load_n(&b->cells[pos & b->mask].seq, __ATOMIC_SEQ_CST);
+  return (long)(seq - pos - get) >= 0;
+}
+
+/* Sleeps until the other side changes b, or for at most LMAIL_POLL_MS */
+static void lmail_sleep(lmail* b, int get) {
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+  t.tv_nsec += LMAIL_POLL_MS * 1000000L;
+  if (t.tv_nsec >= 1000000000L) {
+    t.tv_sec++;
+    t.tv_nsec -= 1000000000L;
+  }
+  pthread_mutex_lock(&b->lock);
+  __atomic_add_fetch(&b->sleepers, 1, __ATOMIC_SEQ_CST);
+  if (!lmail_ready(b, get)) { pthread_cond_timedwait(&b->changed, &b->lock, &t); }
+  __atomic_sub_fetch(&b->sleepers, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&b->lock);
+}
+
+/* Wakes sleepers, if any; the lock is only taken when there are */
+static void lmail_notify(lmail* b) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (!__atomic_load_n(&b->sleepers, __ATOMIC_RELAXED)) { return; }
+  pthread_mutex_lock(&b->lock);
+  pthread_cond_broadcast(&b->changed);
+  pthread_mutex_unlock(&b->lock);
+}
+
+/* Messages queued when the last handle goes are dropped */
+void lmail_unref(lmail* b) {
+  if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) > 0) { return; }
+  lval* x;
+  while ((x = lmail_take(b))) { lval_del(x); }
+  pthread_cond_destroy(&b->changed);
+  pthread_mutex_destroy(&b->lock);
+  free(b->cells);
+  free(b);
+}
+
+/* Sends and receives on b fail from now on, once it is empty */
+void lmail_close(lmail* b) {
+  __atomic_store_n(&b->closed, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&b->lock);
+  pthread_cond_broadcast(&b->changed);
+  pthread_mutex_unlock(&b->lock);
+}
+
+/* Queues x, which must be packed, waiting while b is full. Other tasks
+   of this thread run while it waits. Returns why x could not be queued,
+   having freed it, or NULL. */
+char* lmail_put(lmail* b, lval* x) {
+  for (int spin = 0; ; spin++) {
+    if (__atomic_load_n(&b->closed, __ATOMIC_ACQUIRE)) {
+      lval_del(x);
+      return "Mailbox is closed.";
+    }
+    if (lmail_offer(b, x)) {
+      lmail_notify(b);
+      return NULL;
+    }
+    if (spin < LMAIL_SPIN) {
+      if (!lsched_yield()) { sched_yield(); }
+      continue;
+    }
+    char* stop = llimit_poll();
+    if (stop) {
       lval_del(x);
-      mpc_ast_delete(r.output);
+      return stop;
+    }
+    lmail_sleep(b, 0);
+  }
+}
+
+/* Waits for a message; returns NULL and sets stop if none will come */
+lval* lmail_get(lmail* b, char** stop) {
+  for (int spin = 0; ; spin++) {
+    lval* x = lmail_take(b);
+    if (x) {
+      lmail_notify(b);
+      return x;
+    }
+    if (__atomic_load_n(&b->closed, __ATOMIC_ACQUIRE)) {
+      /* Sent before it closed */
+      x = lmail_take(b);
+      if (!x) { *stop = "Mailbox is closed."; }
+      return x;
+    }
+    if (spin < LMAIL_SPIN) {
+      if (!lsched_yield()) { sched_yield(); }
+      continue;
+    }
+    *stop = llimit_poll();
+    if (*stop) { return NULL; }
+    lmail_sleep(b, 1);
+  }
+}
+
+/* A handle on b, local to this thread's instance */
+lval* lval_mailbox(lmail* b) {
+  lval* v = lval_chan(0);
+  v->chan->mail = lmail_ref(b);
+  return v;
+}
+
+/* Why v cannot go to another instance, or NULL if it can */
+static char* lmail_unsendable(lval* v) {
+  switch (v->type) {
+    case LVAL_SEQ: return ltype_name(v->type);
+    case LVAL_CHAN: return v->chan->mail ? NULL : ltype_name(v->type);
+    case LVAL_FUN:
+      if (v->memo) { return "Memoized Function"; }
+      return v->fun ? NULL : "Lambda";
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      for (int i = 0; i < v->count; i++) {
+        char* t = lmail_unsendable(v->cell[i]);
+        if (t) { return t; }
+      }
+      return NULL;
+    case LVAL_MAP:
+      for (int i = 0; i < v->map->cap; i++) {
+        if (!v->map->slots[i].key) { continue; }
+        char* t = lmail_unsendable(v->map->slots[i].val);
+        if (t) { return t; }
+      }
+      return NULL;
+    default:
+      return NULL;
+  }
+}
+
+/* A copy of v sharing nothing with this instance */
+static lval* lmail_copy(lval* v) {
+  lval* x;
+  switch (v->type) {
+    case LVAL_STR: return lval_str(v->str, v->len);
+    case LVAL_SYM: return lval_sym(v->sym);
+    case LVAL_CHAN: return lval_mailbox(v->chan->mail);
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      x = v->type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+      x->cell = malloc(sizeof(lval*) * v->count);
+      lval_set_count(x, v->count);
+      for (int i = 0; i < v->count; i++) {
+        x->cell[i] = lmail_copy(v->cell[i]);
+      }
+      return x;
+    case LVAL_MAP:
+      x = lval_map();
+      for (int i = 0; i < v->map->cap; i++) {
+        lmap_entry* s = &v->map->slots[i];
+        if (s->key) { lmap_put(x, lmail_copy(s->key), lmail_copy(s->val)); }
+      }
+      return x;
+    default:
+      return lval_copy(v);
+  }
+}
+
+/* Makes v, which the caller owns, safe to give to another thread. Nodes
+   reached only through uniquely owned nodes are moved as they are; the
+   rest is copied. */
+static lval* lmail_pack(lval* v) {
+  if (v->refs != 1 || v->cons) {
+    lval* x = lmail_copy(v);
+    lval_del(v);
+    return x;
+  }
+  switch (v->type) {
+    case LVAL_STR:
+      if (v->strbuf && v->strbuf->refs != 1) {
+        lval* x = lval_str(v->str, v->len);
+        lval_del(v);
+        return x;
+      }
+      break;
+    case LVAL_SYM:
+      /* Resolved slots belong to this instance's frames */
+      v->depth = 0;
+      v->slot = LSLOT_NONE;
+      break;
+    case LVAL_CHAN:
+      if (v->chan->refs != 1) {
+        lval* x = lval_mailbox(v->chan->mail);
+        lval_del(v);
+        return x;
+      }
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      for (int i = 0; i < v->count; i++) {
+        v->cell[i] = lmail_pack(v->cell[i]);
+      }
+      /* Compiled code reads this instance's globals */
+      if (v->jit) {
+        ljit_free(v->jit);
+        v->jit = NULL;
+      }
+      v->hot = 0;
+      break;
+    case LVAL_MAP:
+      for (int i = 0; i < v->map->cap; i++) {
+        lmap_entry* s = &v->map->slots[i];
+        if (!s->key) { continue; }
+        s->key = lmail_pack(s->key);
+        s->val = lmail_pack(s->val);
+      }
+      break;
+  }
+  return v;
+}
+
+void lactors_init(lactors* a) {
+  a->self = NULL;
+  a->spawned = NULL;
+}
+
+static void lactor_free(lactor* a) {
+  pthread_join(a->thread, NULL);
+  mylisp_free(a->m);
+  lmail_unref(a->inbox);
+  free(a->code);
+  free(a);
+}
+
+/* An actor that fails reports it, unless it was stopped by its spawner
+   closing its mailbox */
+static void* lactor_main(void* arg) {
+  lactor* a = arg;
+  char* out = mylisp_eval_string(a->m, a->code);
+  if (strncmp(out, "Error: ", 7) == 0
+      && !__atomic_load_n(&a->inbox->closed, __ATOMIC_ACQUIRE)) {
+    printf("%s\n", out);
+    fflush(stdout);
+  }
+  free(out);
+  lmail_close(a->inbox);
+  __atomic_store_n(&a->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/* Joins the actors that have finished */
+static void lactors_reap(lactors* s) {
+  lactor** p = &s->spawned;
+  while (*p) {
+    lactor* a = *p;
+    if (__atomic_load_n(&a->done, __ATOMIC_ACQUIRE)) {
+      *p = a->next;
+      lactor_free(a);
     } else {
-      mpc_err_print(r.error);
-      mpc_err_delete(r.error);
+      p = &a->next;
+    }
+  }
+}
+
+/* Closes every mailbox so blocked actors stop, and cancels running ones,
+   then waits for them. The cancel is repeated until the actor is done,
+   since one that is only starting its evaluation would clear it. */
+void lactors_free(lactors* s) {
+  for (lactor* a = s->spawned; a; a = a->next) { lmail_close(a->inbox); }
+  if (s->self) { lmail_close(s->self); }
+  struct timespec pause = { 0, 1000000 };
+  for (lactor* a = s->spawned; a; a = a->next) {
+    while (!__atomic_load_n(&a->done, __ATOMIC_ACQUIRE)) {
+      mylisp_cancel(a->m);
+      nanosleep(&pause, NULL);
     }
+  }
+  while (s->spawned) {
+    lactor* a = s->spawned;
+    s->spawned = a->next;
+    lactor_free(a);
+  }
+  if (s->self) {
+    lmail_unref(s->self);
+    s->self = NULL;
+  }
+}
+
+/* actor-spawn {code} evaluates code, as eval would, in a new instance on
+   its own thread, where self is its mailbox and parent the spawner's.
+   The spawner's self is bound on its first spawn. Returns the new
+   actor's mailbox. */
+lval* builtin_actor_spawn(lenv* e, lval* v) {
+  LASSERT(v, v->count == 1,
+    "Function 'actor-spawn' passed incorrect number of arguments.\nGot %i, Expected %i.",
+    v->count, 1);
+  LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
+    "Function 'actor-spawn' passed invalid type.\nGot %s, Expected %s.",
+    ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+  lactors* s = lcur->actors;
+  LASSERT(v, s, "Function 'actor-spawn' must run in an interpreter instance.");
+  lenv* root = e;
+  while (root->par) { root = root->par; }
+  LASSERT(v, !root->shared,
+    "Function 'actor-spawn' cannot bind self in a shared environment.");
 
-    free(input);
+  lactors_reap(s);
+  if (!s->self) {
+    s->self = lmail_new();
+    lenv_bind(root, "self", lval_mailbox(s->self));
   }
-  lenv_del(e);
-  mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, MyLisp);
 
-  return 0;
+  lactor* a = malloc(sizeof(lactor));
+  a->m = mylisp_new();
+  a->inbox = lmail_new();
+  a->done = 0;
+  a->m->actors.self = lmail_ref(a->inbox);
+  lctx c = *lcur;
+  c.load = NULL;
+  lctx* prev = lctx_enter(&c);
+  lenv_bind(a->m->env, "self", lval_mailbox(a->inbox));
+  lenv_bind(a->m->env, "parent", lval_mailbox(s->self));
+  lctx_leave(prev);
+
+  /* The new instance reads the code afresh, so it shares nothing */
+  lval* code = v->cell[0];
+  lbuf b;
+  lbuf_init(&b, -1);
+  lbuf_putc(&b, '(');
+  for (int i = 0; i < code->count; i++) {
+    if (i) { lbuf_putc(&b, ' '); }
+    lbuf_lval(&b, code->cell[i]);
+  }
+  lbuf_putc(&b, ')');
+  lbuf_putc(&b, '\0');
+  a->code = b.data;
+
+  if (pthread_create(&a->thread, NULL, lactor_main, a) != 0) {
+    mylisp_free(a->m);
+    lmail_unref(a->inbox);
+    free(a->code);
+    free(a);
+    lval_del(v);
+    return lval_err("Function 'actor-spawn' could not start a thread.");
+  }
+  a->next = s->spawned;
+  s->spawned = a;
+  lval_del(v);
+  return lval_mailbox(a->inbox);
 }
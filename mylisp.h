@@ -1,24 +1,94 @@
+#include <signal.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "mpc.h"
 
 struct lval;
 struct lenv;
+struct lmemo;
+struct lseq;
+struct lstr;
+struct lmap;
+struct ljit;
+struct lchan;
+struct lcons;
+struct lbin;
+struct lmail;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lmemo lmemo;
+typedef struct lseq lseq;
+typedef struct lstr lstr;
+typedef struct lmap lmap;
+typedef struct ljit ljit;
+typedef struct lchan lchan;
+typedef struct lcons lcons;
+typedef struct lbin lbin;
+typedef struct lmail lmail;
+typedef struct mylisp mylisp;
 typedef lval* (*lbuiltin) (lenv*, lval*);
 
+/* Symbol slot markers; slot >= 0 is a resolved local */
+enum { LSLOT_NONE = -1, LSLOT_GLOBAL = -2 };
+
 /* LISP Value ENUM Types */
-enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
+enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR,
+  LVAL_SEQ, LVAL_STR, LVAL_MAP, LVAL_CHAN };
+
+/* Strings up to this many bytes are stored inside the lval */
+#define LSTR_INLINE 16
+
+/* Reference count of a value published to a shared env. It is never
+   changed again, so threads reading the env never write to the value. */
+#define LREFS_SHARED INT_MAX
+
+/* Hot arithmetic expressions are compiled to native code on x86-64 */
+#if defined(__x86_64__) && !defined(MYLISP_NO_JIT)
+#define LJIT
+#endif
 
 /* LISP Value Type */
 
 struct lval {
   int type;
-  long num;
-  char* err;
-  char* sym;
-  lbuiltin fun;
-  int count;
-  struct lval** cell;
+  int refs;
+  int edges;
+  unsigned long hash;
+  lcons* cons;
+
+  /* Payload, by type */
+  union {
+    long num;
+    char* err;
+    struct {
+      char* sym;
+      int depth;
+      int slot;
+    };
+    struct {
+      char* str;
+      size_t len;
+      lstr* strbuf;
+      char small[LSTR_INLINE];
+    };
+    struct {
+      lbuiltin fun;
+      lenv* env;
+      struct lval* formals;
+      struct lval* body;
+      lmemo* memo;
+    };
+    lseq* seq;
+    lmap* map;
+    lchan* chan;
+    struct {
+      int count;
+      int hot;
+      struct lval** cell;
+      ljit* jit;
+    };
+  };
 };
 
 /* LISP Value Functions */
@@ -27,39 +97,577 @@ lval* lval_num(long n);
 lval* lval_err(char* e, ...);
 lval* lval_sym(char* s);
 lval* lval_fun(lbuiltin f);
+lval* lval_lambda(lval* formals, lval* body, lenv* env);
 lval* lval_sexpr(void);
 lval* lval_qexpr(void);
+lval* lval_seq(int kind, lval* src);
+lval* lval_str(const char* s, size_t len);
+lval* lval_str_slice(lval* v, size_t start, size_t len);
+lval* lval_map(void);
+lval* lval_chan(int cap);
 
 lval* lval_copy(lval* v);
+lval* lval_ref(lval* v);
+lval* lval_own(lval* v);
+int lval_unique(lval* v);
 void lval_del(lval* v);
 char* ltype_name(int t);
 
 lval* lval_add(lval* v, lval* k);
 lval* lval_pop(lval* v, int i);
+lval* lval_steal(lval* v, int i);
 lval* lval_take(lval* v, int i);
 lval* lval_join(lval* v, lval* k);
 
+lval* lval_call(lenv* e, lval* f, lval* a);
+lval* lval_memo(lval* f, int max_entries, size_t max_bytes);
+void lval_resolve(lval* v, lval* formals, lenv* e);
+
+unsigned long lval_hash(lval* v);
+int lval_eq(lval* x, lval* y);
+int lval_cmp(lval* x, lval* y);
+size_t lval_bytes(lval* v);
+
+/* Memoization Cache Type */
+
+typedef struct lmemo_entry {
+  unsigned long hash;
+  size_t bytes;
+  lval* args;
+  lval* result;
+  struct lmemo_entry* chain;
+  struct lmemo_entry* prev;
+  struct lmemo_entry* next;
+} lmemo_entry;
+
+struct lmemo {
+  int refs;
+  lval* fn;
+  int nbuckets;
+  lmemo_entry** buckets;
+  lmemo_entry* head;
+  lmemo_entry* tail;
+  int count;
+  int max_entries;
+  size_t bytes;
+  size_t max_bytes;
+  long hits;
+  long misses;
+};
+
+/* Shared String Storage Type */
+
+/* Long strings are immutable and shared by copies and slices */
+struct lstr {
+  int refs;
+  int edges;
+  size_t len;
+  char data[];
+};
+
+/* Hash Map Type */
+
+/* Open addressing with linear probing; cap is a power of two */
+typedef struct {
+  unsigned long hash;
+  lval* key;
+  lval* val;
+} lmap_entry;
+
+struct lmap {
+  int count;
+  int cap;
+  lmap_entry* slots;
+};
+
+lval* lmap_get(lval* m, lval* k);
+void lmap_put(lval* m, lval* k, lval* v);
+int lmap_del(lval* m, lval* k);
+
+/* Hash-Consing Table Type */
+
+/* Canonical nodes of immutable literals, open addressed by their cached
+   hash. The table holds a reference to each node, so a canonical node is
+   always shared and never mutated in place. */
+struct lcons {
+  int count;
+  int cap;
+  lval** slots;
+};
+
+void lcons_init(lcons* c);
+void lcons_free(lcons* c);
+lval* lcons_intern(lcons* c, lval* v);
+
+/* Green Thread Types */
+
+/* Tasks switch with a few instructions on x86-64, else through ucontext */
+#if defined(__x86_64__) && defined(__ELF__) && !defined(MYLISP_UCONTEXT)
+#define LTASK_ASM
+#else
+#include <ucontext.h>
+#endif
+
+/* Stack reserved per task; pages are only committed as they are used */
+#define LTASK_STACK (8 << 20)
+
+/* A running task is switched out after this many steps if others wait */
+#define LTASK_SLICE 1000
+
+enum { LTASK_READY, LTASK_RUNNING, LTASK_BLOCKED, LTASK_DONE };
+
+/* FIFO of tasks; a task is in at most one queue at a time */
+typedef struct {
+  struct ltask* head;
+  struct ltask* tail;
+} ltask_queue;
+
+typedef struct ltask {
+  int id;
+  int state;
+  int deadlock;
+  int pinned;
+#ifdef LTASK_ASM
+  void* sp;
+#else
+  ucontext_t ctx;
+#endif
+  char* stack;
+  char* top;
+  long depth;
+  struct lprof_frame* prof;
+  lval* fn;
+  lval* args;
+  lval* result;
+  ltask_queue joiners;
+  ltask_queue* wait;
+  struct ltask* next;
+} ltask;
+
+/* The thread that drives the interpreter runs as task 0 */
+typedef struct {
+  ltask main;
+  ltask* current;
+  ltask** tasks;
+  int count;
+  ltask_queue ready;
+  char* zombie;
+  int slice;
+  lenv* env;
+} lsched;
+
+void lsched_init(lsched* s, lenv* env);
+void lsched_free(lsched* s);
+void lsched_preempt(void);
+int lsched_yield(void);
+int lsched_block(ltask_queue* q);
+void lsched_wake(ltask_queue* q);
+#ifdef LTASK_ASM
+void ltask_swap(void** from, void* to);
+#endif
+
+/* Channel Type */
+
+/* A ring of values; cap 0 means unbounded. A channel with a mail is
+   instead a handle on an actor's mailbox and uses none of the rest. */
+struct lchan {
+  int refs;
+  int cap;
+  int count;
+  int head;
+  int size;
+  lval** items;
+  ltask_queue senders;
+  ltask_queue receivers;
+  lmail* mail;
+};
+
+/* Native Code Type */
+
+/* An expression is compiled after being evaluated this many times; one
+   that cannot be compiled is left at this count and not tried again */
+#define LJIT_HOT 16
+
+/* A global binding compiled code read, by its index in the root env. The
+   value is referenced so it cannot be freed and its address reused. */
+typedef struct {
+  int slot;
+  lval* val;
+} ljit_dep;
+
+/* Compiled code is only valid while the global bindings it read are.
+   version is the root's when they were last seen unchanged. */
+struct ljit {
+  void* code;
+  size_t size;
+  lenv* root;
+  unsigned long version;
+  int ndeps;
+  ljit_dep* deps;
+};
+
+int ljit_run(lenv* e, lval* v, long* out);
+void ljit_free(ljit* j);
+
+/* Lazy Sequence Type */
+
+enum { LSEQ_RANGE, LSEQ_TAKE, LSEQ_DROP, LSEQ_MAP, LSEQ_FILTER, LSEQ_FILE,
+  LSEQ_NUMS };
+
+/* Elements are pulled from a sequence this many at a time */
+#define LSEQ_CHUNK 4096
+
+/* Numbers read from a file, shared by the sequences over them */
+typedef struct {
+  int refs;
+  long count;
+  long* data;
+} lnums;
+
+struct lseq {
+  int kind;
+  long cur;
+  long end;
+  long step;
+  long n;
+  lval* src;
+  lval* fn;
+  lbin* bin;
+  lnums* nums;
+};
+
+int lseq_numeric(lval* s);
+int lseq_next(lenv* e, lval* s, lval** buf, int max);
+int lseq_next_num(lval* s, long* buf, int max);
+
+/* Evaluation Limit Type */
+
+/* The clock is read once per this many steps */
+#define LLIMIT_CLOCK 256
+
+/* Function calls may nest this deep */
+#define LLIMIT_DEPTH 10000
+
+/* C stack an evaluation may use; builtins like reduce put frames of
+   their own between calls, so depth alone does not bound it */
+#define LLIMIT_STACK (6 << 20)
+
+typedef struct {
+  long max_steps;
+  long max_bytes;
+  long max_ms;
+  long steps;
+  long depth;
+  long bytes;
+  long start;
+  char* stack;
+  volatile sig_atomic_t cancel;
+  char* stop;
+} llimit;
+
+void llimit_start(llimit* l);
+void llimit_reset(void);
+int llimit_cancelled(void);
+void llimit_bytes(long n);
+char* llimit_poll(void);
+char* llimit_push(void);
+void llimit_pop(void);
+
+/* Background Reclaimer Type */
+
+/* Dead lists and maps with at least this many elements are freed by the
+   instance's reclaimer thread instead of by the caller */
+#define LRECLAIM_MIN 4096
+
+/* At most this many values wait during one evaluation; past that
+   lval_del frees in place */
+#define LRECLAIM_QUEUE 64
+
+/* Elements of leftover garbage an evaluation frees per allocation */
+#define LRECLAIM_STEP 4
+
+/* Elements the thread frees before it checks for a waiting evaluation */
+#define LRECLAIM_BATCH 1024
+
+/* Counts are not atomic, so the thread frees only while holding lock,
+   which the instance holds while it evaluates, and gives it up between
+   batches to an instance waiting to evaluate. Whatever the thread has
+   not freed by the next evaluation is freed by that evaluation a few
+   elements per allocation, so it outpaces new garbage and no single step
+   pays for a whole tree. Nested lists wait on stack rather than being
+   freed by recursion. */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  pthread_t thread;
+  int started;
+  int stop;
+  int freeing;
+  int waiting;
+  int head;
+  int count;
+  lval* queue[LRECLAIM_QUEUE];
+  lval** stack;
+  int depth;
+  int cap;
+} lreclaim;
+
+void lreclaim_init(lreclaim* r);
+void lreclaim_free(lreclaim* r);
+void lreclaim_lock(lreclaim* r);
+void lreclaim_unlock(lreclaim* r);
+lreclaim* lreclaim_pause(void);
+void lreclaim_resume(lreclaim* r);
+
+/* Evaluation Trace Type */
+
+/* Events kept per instance, a power of two; older ones are overwritten */
+#define LTRACE_SIZE 65536
+
+#define LTRACE_MAGIC "MLTRACE1"
+
+enum { LTRACE_ENTER, LTRACE_EXIT };
+
+/* One function call boundary. fn is the builtin's address, or 0 for a
+   lambda; n is the argument count on entry and result type on exit. */
+typedef struct {
+  uint64_t ns;
+  uint64_t fn;
+  uint32_t kind;
+  uint32_t n;
+} ltrace_rec;
+
+/* A dump is this header, the name table, then the events oldest first.
+   Each name is its builtin's address, a uint32_t length and the bytes. */
+typedef struct {
+  char magic[8];
+  uint32_t names;
+  uint32_t count;
+  uint64_t total;
+} ltrace_hdr;
+
+/* A name table. Tables are published whole, and a replaced one is kept
+   until ltrace_free, as a dump in a signal handler may still read it. */
+typedef struct ltrace_names {
+  struct ltrace_names* prev;
+  size_t len;
+  char data[];
+} ltrace_names;
+
+/* Only the evaluating thread writes, so no locks are needed; a dump from
+   a signal handler may see the newest event half written */
+typedef struct {
+  volatile int on;
+  volatile unsigned long head;
+  ltrace_rec* ring;
+  ltrace_names* names;
+} ltrace;
+
+void ltrace_init(ltrace* t);
+void ltrace_free(ltrace* t);
+void ltrace_start(ltrace* t, lenv* e);
+int ltrace_dump(ltrace* t, const char* path);
+
+/* Sampling Profiler Type */
+
+#define LPROF_HZ 1000
+
+/* Samples keep at most this many innermost frames */
+#define LPROF_DEPTH 256
+
+/* Shadow stack entry for a call in progress, labelled by the symbol the
+   call was made through. Frames live on the C stack of their task. */
+typedef struct lprof_frame {
+  lval* head;
+  struct lprof_frame* up;
+} lprof_frame;
+
+typedef struct {
+  char* stack;
+  unsigned long hash;
+  long count;
+} lprof_entry;
+
+/* SIGPROF only counts ticks; the evaluator folds its shadow stack into
+   the sample table at the next call boundary, where it is still the
+   stack the ticks hit */
+typedef struct {
+  volatile sig_atomic_t ticks;
+  lprof_frame* top;
+  char* path;
+  int count;
+  int cap;
+  lprof_entry* slots;
+} lprof;
+
+void lprof_init(lprof* p);
+int lprof_start(lprof* p, int hz, const char* path);
+int lprof_stop(lprof* p);
+
+/* Form Timing Type */
+
+/* Histograms keep this many buckets per power of two, so a recorded
+   latency is exact to within 1/LHIST_SUB of itself */
+#define LHIST_SUB 32
+#define LHIST_BUCKETS (60 * LHIST_SUB)
+
+/* HDR style log-linear histogram of nanosecond latencies */
+typedef struct {
+  uint64_t count;
+  uint64_t max;
+  uint64_t buckets[LHIST_BUCKETS];
+} lhist;
+
+void lhist_add(lhist* h, uint64_t ns);
+uint64_t lhist_quantile(lhist* h, double q);
+
+enum { LTIME_READ, LTIME_EVAL, LTIME_PRINT, LTIME_PHASES };
+
+/* Slowest forms kept when no count is given */
+#define LTIME_TOP 20
+
+typedef struct {
+  uint64_t ns[LTIME_PHASES];
+  uint64_t total;
+  char* where;
+  char* text;
+} ltime_form;
+
+/* Each top-level form is timed phase by phase; the slowest top forms are
+   kept in a min-heap by total, with a copy of their source */
+typedef struct {
+  int on;
+  lhist phases[LTIME_PHASES];
+  uint64_t mark;
+  ltime_form form;
+  const char* src;
+  size_t len;
+  int top;
+  int count;
+  ltime_form* slow;
+  char* csv;
+} ltime;
+
+void ltime_init(ltime* t);
+int ltime_start(ltime* t, int top, const char* csv);
+int ltime_stop(ltime* t);
+
+/* Actor Types */
+
+/* Messages a mailbox holds before senders wait; a power of two */
+#define LMAIL_CAP 1024
+
+/* Times a blocked sender or receiver retries before it sleeps, and how
+   long it sleeps between checks for cancellation */
+#define LMAIL_SPIN 64
+#define LMAIL_POLL_MS 50
+
+/* A cell is free for the sender at position seq, and holds a message
+   for the receiver at position seq - 1 */
+typedef struct {
+  size_t seq;
+  lval* val;
+} lmail_cell;
+
+/* Bounded lock-free queue between threads, any number of either side.
+   head and tail are apart so senders and receivers do not share a cache
+   line; the lock only guards sleeping. */
+struct lmail {
+  int refs;
+  int closed;
+  size_t mask;
+  lmail_cell* cells;
+  char pad0[64];
+  size_t head;
+  char pad1[64];
+  size_t tail;
+  char pad2[64];
+  int sleepers;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+
+lmail* lmail_new(void);
+lmail* lmail_ref(lmail* b);
+void lmail_unref(lmail* b);
+void lmail_close(lmail* b);
+char* lmail_put(lmail* b, lval* x);
+lval* lmail_get(lmail* b, char** stop);
+lval* lval_mailbox(lmail* b);
+
+/* An instance evaluating code on its own thread */
+typedef struct lactor {
+  mylisp* m;
+  char* code;
+  lmail* inbox;
+  pthread_t thread;
+  int done;
+  struct lactor* next;
+} lactor;
+
+/* An instance's own mailbox, made when it first spawns, and the actors
+   it spawned */
+typedef struct {
+  lmail* self;
+  lactor* spawned;
+} lactors;
+
+void lactors_init(lactors* a);
+void lactors_free(lactors* a);
+
 /* LISP Environment Type */
 
 struct lenv {
+  struct lenv* par;
+  int refs;
+  int edges;
+  unsigned long version;
   int count;
+  int shared;
   char** syms;
   lval** vals;
+  /* A call frame's formals, whose symbols name its first slots */
+  lval* formals;
 };
 
 /* LISP Envinronment Functions */
 
 lenv* lenv_new(void);
+lenv* lenv_frame(lenv* par, int n);
+lenv* lenv_ref(lenv* e);
+void lenv_unref(lenv* e);
 lval* lenv_get(lenv* e, lval* v);
 void lenv_put(lenv* e, lval* k, lval* v);
+void lenv_put_move(lenv* e, lval* k, lval* v);
+void lenv_def(lenv* e, lval* k, lval* v);
+void lenv_def_move(lenv* e, lval* k, lval* v);
 void lenv_del(lenv* e);
 
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func);
 void lenv_add_builtins(lenv* e);
 
+/* Shared Environment Type */
+
+/* Every evaluator of a shared env holds one of these; epoch is the
+   global epoch it announced when it last started or paused, 0 when it
+   holds nothing from the env */
+typedef struct lepoch {
+  unsigned long epoch;
+  int joined;
+  struct lepoch* next;
+} lepoch;
+
+int lenv_share(lenv* e);
+void lepoch_init(lepoch* p);
+void lepoch_join(lepoch* p);
+void lepoch_quit(lepoch* p);
+void lepoch_begin(lepoch* p);
+void lepoch_end(lepoch* p);
+
 /* Read & Eval */
 lval* lval_read(mpc_ast_t* t);
 lval* lval_read_num(mpc_ast_t* t);
+lval* lval_read_str(mpc_ast_t* t);
 
 lval* lval_eval(lenv* e, lval* v);
 lval* lval_eval_sexpr(lenv* e, lval* v);
@@ -68,8 +676,15 @@ lval* lval_eval_sexpr(lenv* e, lval* v);
 lval* builtin(lenv* e, lval* v, char* func);
 
 lval* builtin_def(lenv* e, lval* v);
+lval* builtin_lambda(lenv* e, lval* v);
+
+enum { LOP_ADD, LOP_SUB, LOP_MUL, LOP_DIV, LOP_MOD, LOP_EXP, LOP_MIN, LOP_MAX,
+  LOP_NONE };
 
+int lop_code(char* op);
+char* lop_num(int op, long* x, long y);
 lval* builtin_op(lenv* e, lval* v, char* op);
+char* builtin_op_name(lbuiltin f);
 lval* builtin_add(lenv* e, lval* v);
 lval* builtin_sub(lenv* e, lval* v);
 lval* builtin_mul(lenv* e, lval* v);
@@ -78,6 +693,9 @@ lval* builtin_min(lenv* e, lval* v);
 lval* builtin_max(lenv* e, lval* v);
 lval* builtin_mod(lenv* e, lval* v);
 lval* builtin_exp(lenv* e, lval* v);
+lval* builtin_lt(lenv* e, lval* v);
+lval* builtin_gt(lenv* e, lval* v);
+lval* builtin_eq(lenv* e, lval* v);
 
 lval* builtin_list(lenv* e, lval* v);
 lval* builtin_len(lenv* e, lval* v);
@@ -86,8 +704,220 @@ lval* builtin_init(lenv* e, lval* v);
 lval* builtin_tail(lenv* e, lval* v);
 lval* builtin_eval(lenv* e, lval* v);
 lval* builtin_join(lenv* e, lval* v);
+lval* builtin_map(lenv* e, lval* v);
+lval* builtin_filter(lenv* e, lval* v);
+lval* builtin_foldl(lenv* e, lval* v);
+lval* builtin_foldr(lenv* e, lval* v);
+
+/* Numeric lists at least this long are radix sorted */
+#define LSORT_RADIX 64
+
+lval* builtin_sort(lenv* e, lval* v);
+lval* builtin_sort_by(lenv* e, lval* v);
+
+lval* builtin_range(lenv* e, lval* v);
+lval* builtin_take(lenv* e, lval* v);
+lval* builtin_drop(lenv* e, lval* v);
+lval* builtin_reduce(lenv* e, lval* v);
+lval* builtin_collect(lenv* e, lval* v);
+
+lval* builtin_str_len(lenv* e, lval* v);
+lval* builtin_substr(lenv* e, lval* v);
+lval* builtin_str_join(lenv* e, lval* v);
+lval* builtin_str_find(lenv* e, lval* v);
+
+lval* builtin_map_new(lenv* e, lval* v);
+lval* builtin_map_get(lenv* e, lval* v);
+lval* builtin_map_put(lenv* e, lval* v);
+lval* builtin_map_del(lenv* e, lval* v);
+lval* builtin_map_keys(lenv* e, lval* v);
+
+lval* builtin_memo(lenv* e, lval* v);
+lval* builtin_memo_stats(lenv* e, lval* v);
+
+lval* builtin_spawn(lenv* e, lval* v);
+lval* builtin_yield(lenv* e, lval* v);
+lval* builtin_join_task(lenv* e, lval* v);
+lval* builtin_chan(lenv* e, lval* v);
+lval* builtin_send(lenv* e, lval* v);
+lval* builtin_recv(lenv* e, lval* v);
+lval* builtin_actor_spawn(lenv* e, lval* v);
+
+lval* builtin_trace(lenv* e, lval* v);
+lval* builtin_trace_dump(lenv* e, lval* v);
+
+lval* builtin_load(lenv* e, lval* v);
+lval* builtin_save(lenv* e, lval* v);
+lval* builtin_restore(lenv* e, lval* v);
+lval* builtin_restore_seq(lenv* e, lval* v);
+
+lval* builtin_read_file(lenv* e, lval* v);
+lval* builtin_read_lines(lenv* e, lval* v);
+lval* builtin_read_numbers(lenv* e, lval* v);
+lval* builtin_write_file(lenv* e, lval* v);
+
+/* Streaming Reader Type */
+
+/* Consumed input is released back to the OS in steps of this size */
+#define LREADER_RELEASE (64 << 20)
+
+typedef struct {
+  int fd;
+  char* data;
+  size_t len;
+  size_t pos;
+  size_t released;
+} lreader;
+
+int lreader_open(lreader* r, char* path);
+int lreader_next(lreader* r, size_t* start, size_t* len);
+void lreader_locate(lreader* r, size_t off, long* row, long* col);
+void lreader_close(lreader* r);
+int lval_eval_file(lenv* e, mpc_parser_t* p, char* path);
+
+/* Parallel Reader Type */
+
+/* Forms are parsed in windows of about this many bytes, one window at a
+   time, so memory stays bounded for any file size. Parsed values take
+   many times their source size, so larger windows lose to cache misses. */
+#define LREAD_WINDOW (1 << 20)
+
+/* Parses forms from..to of a window on one thread. A form that fails to
+   parse leaves its error instead of its value. */
+typedef struct {
+  mpc_parser_t* parser;
+  char* path;
+  lreader* r;
+  size_t* spans;
+  int from;
+  int to;
+  lval** forms;
+  long* bytes;
+  uint64_t* reads;
+  mpc_err_t** errs;
+} lread_job;
+
+int lval_eval_file_parallel(lenv* e, mpc_parser_t* p, char* path, int threads);
+
+/* Incremental Load Types */
+
+/* A top-level form of a loaded file: the hash of its text and the global
+   names it read and defined when last evaluated */
+typedef struct {
+  unsigned long hash;
+  size_t start;
+  size_t len;
+  char** reads;
+  int nreads;
+  char** writes;
+  int nwrites;
+} lload_form;
+
+typedef struct lload_file {
+  char* path;
+  lload_form* forms;
+  int count;
+  int busy;
+  struct lload_file* next;
+} lload_file;
+
+/* Files an instance has loaded; form is the record being filled in */
+typedef struct {
+  mpc_parser_t* parser;
+  lload_file* files;
+  lload_form* form;
+  char* last;
+} lload;
+
+void lload_init(lload* l, mpc_parser_t* parser);
+void lload_free(lload* l);
+long lload_run(lload* l, lenv* e, char* path);
+
+/* Binary Value Type */
+
+/* A saved file is the magic, a version byte, then one value. A value is
+   a tag byte followed by a zigzag varint for a number; a varint length
+   and the bytes for an error, symbol or string; a varint count and the
+   elements for a list; or a varint count and key, value pairs for a map. */
+#define LBIN_MAGIC "MLVALUE"
+#define LBIN_VERSION 1
+
+enum { LBIN_NUM, LBIN_ERR, LBIN_SYM, LBIN_STR, LBIN_SEXPR, LBIN_QEXPR,
+  LBIN_MAP };
+
+/* Saved lists may nest this deep */
+#define LBIN_DEPTH 10000
+
+/* A mapped file, shared by the sequences reading from it */
+struct lbin {
+  int refs;
+  lreader r;
+};
+
+int lbin_save(lval* v, char* path);
+lval* lbin_load(char* path);
+lval* lbin_seq(char* path);
+lval* lnums_seq(char* path);
+
+/* Output Buffer Type */
+
+/* Streaming buffers write out once they hold this many bytes */
+#define LBUF_FLUSH 65536
+
+typedef struct {
+  int fd;
+  size_t len;
+  size_t cap;
+  char* data;
+} lbuf;
+
+void lbuf_init(lbuf* b, int fd);
+void lbuf_flush(lbuf* b);
+void lbuf_put(lbuf* b, const char* s, size_t n);
+void lbuf_puts(lbuf* b, const char* s);
+void lbuf_putc(lbuf* b, char c);
+void lbuf_num(lbuf* b, long n);
+void lbuf_lval(lbuf* b, lval* v);
 
 /* Print functions */
 void lval_print(lval* v);
 void lval_expr_print(lval* v, char open, char close);
 void lval_println(lval* v);
+char* lval_to_string(lval* v);
+
+/* Evaluation Context Type */
+
+/* Everything the evaluation running on a thread works with, set once
+   when an instance is entered; members not in use are NULL */
+typedef struct {
+  llimit* limit;
+  /* A reclaimer thread's context has only its own reclaimer */
+  lreclaim* reclaim;
+  lsched* sched;
+  /* Table the reader interns literals into */
+  lcons* cons;
+  ltrace* trace;
+  lprof* prof;
+  ltime* time;
+  lload* load;
+  lepoch* epoch;
+  lactors* actors;
+} lctx;
+
+lctx* lctx_enter(lctx* c);
+void lctx_leave(lctx* prev);
+
+/* Embedding API; one instance per thread */
+mylisp* mylisp_new(void);
+mylisp* mylisp_attach(mylisp* m);
+char* mylisp_eval_string(mylisp* m, const char* src);
+int mylisp_eval_file(mylisp* m, char* path);
+void mylisp_free(mylisp* m);
+void mylisp_limit(mylisp* m, long steps, long bytes, long ms);
+void mylisp_cancel(mylisp* m);
+void mylisp_hashcons(mylisp* m, int on);
+void mylisp_trace(mylisp* m, int on);
+int mylisp_trace_dump(mylisp* m, const char* path);
+int mylisp_profile(mylisp* m, int hz, const char* path);
+int mylisp_time(mylisp* m, int top, const char* csv);
+void mylisp_readers(mylisp* m, int n);
@@ -0,0 +1,133 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "mylisp.h"
+
+#ifdef _WIN32
+
+/* Optional case of no editline package */
+static char buffer[2048];
+
+char* readline(char* prompt) {
+  fputs(prompt, stdout);
+  fgets(buffer, 2048, stdin);
+  char* cpy = malloc(strlen(buffer)+1);
+  strpcy(cpy,buffer);
+  cpy[strlen(cpy)-1] = '\0';
+  return cpy;
+}
+
+void add_history(char* unused) {}
+
+#else
+#include <editline/readline.h>
+#include <editline/history.h>
+#endif
+
+/* Ctrl+c cancels the running evaluation, or exits at the prompt */
+static mylisp* repl;
+static volatile sig_atomic_t evaluating;
+
+static void repl_interrupt(int sig) {
+  if (evaluating) {
+    mylisp_cancel(repl);
+    return;
+  }
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+/* SIGUSR1 writes the call trace out without stopping anything */
+static void repl_dump_trace(int sig) {
+  mylisp_trace_dump(repl, "mylisp.trace");
+}
+
+/**/
+/* Main */
+/**/
+
+int main(int argc, char** argv) {
+
+  mylisp* m = mylisp_new();
+  repl = m;
+  signal(SIGUSR1, repl_dump_trace);
+
+  /* Options come before any files */
+  int first = 1;
+  char* profile = NULL;
+  int hz = LPROF_HZ;
+  int timed = 0;
+  int top = LTIME_TOP;
+  char* csv = NULL;
+  for (; first < argc && argv[first][0] == '-'; first++) {
+    if (strcmp(argv[first], "--hashcons") == 0) {
+      mylisp_hashcons(m, 1);
+    } else if (strcmp(argv[first], "--trace") == 0) {
+      mylisp_trace(m, 1);
+    } else if (strcmp(argv[first], "--profile") == 0 && first + 1 < argc) {
+      profile = argv[++first];
+    } else if (strcmp(argv[first], "--profile-hz") == 0 && first + 1 < argc) {
+      hz = atoi(argv[++first]);
+    } else if (strcmp(argv[first], "--readers") == 0 && first + 1 < argc) {
+      mylisp_readers(m, atoi(argv[++first]));
+    } else if (strcmp(argv[first], "--time") == 0) {
+      timed = 1;
+    } else if (strcmp(argv[first], "--time-csv") == 0 && first + 1 < argc) {
+      timed = 1;
+      csv = argv[++first];
+    } else if (strcmp(argv[first], "--time-top") == 0 && first + 1 < argc) {
+      top = atoi(argv[++first]);
+    } else {
+      fprintf(stderr, "Unknown option '%s'\n", argv[first]);
+      mylisp_free(m);
+      return 1;
+    }
+  }
+  if (timed && !mylisp_time(m, top, csv)) {
+    fprintf(stderr, "Could not keep the %i slowest forms\n", top);
+    mylisp_free(m);
+    return 1;
+  }
+  if (profile && !mylisp_profile(m, hz, profile)) {
+    fprintf(stderr, "Could not start the profiler at %i Hz\n", hz);
+    mylisp_free(m);
+    return 1;
+  }
+
+  /* Batch mode: evaluate each file given on the command line */
+  if (first < argc) {
+    int status = 0;
+    for (int i = first; i < argc; i++) {
+      if (!mylisp_eval_file(m, argv[i])) {
+        fprintf(stderr, "Could not open file '%s'\n", argv[i]);
+        status = 1;
+      }
+    }
+    mylisp_free(m);
+    return status;
+  }
+
+  puts("MyLisp Version 0.0.5");
+  puts("Press Ctrl+c to Exit\n");
+
+  signal(SIGINT, repl_interrupt);
+
+  while (1) {
+    char* input = readline("MyLisp> ");
+    if (!input) { break; }
+    add_history(input);
+
+    evaluating = 1;
+    char* out = mylisp_eval_string(m, input);
+    evaluating = 0;
+    puts(out);
+    free(out);
+
+    free(input);
+  }
+  mylisp_free(m);
+
+  return 0;
+}
@@ -0,0 +1,18 @@
+(def {echo} (actor-spawn {foldl (\ {n i} {send parent (recv self)}) 0 {1 2 3}}))
+(send echo 21)
+(recv self)
+(send echo {1 {2 "s"}})
+(send echo "s")
+(recv self)
+(recv self)
+(def {summer} (actor-spawn {send parent (reduce + (recv self))}))
+(send summer (collect (range 0 10000)))
+(recv self)
+(def {nested} (actor-spawn {send parent (+ 1 (eval (head (tail (list (actor-spawn {send parent 41}) (recv self))))))}))
+(recv self)
+(def {a} (actor-spawn {send parent 1}))
+(def {b} (actor-spawn {send parent 2}))
+(+ (recv self) (recv self))
+(send summer (\ {x} {x}))
+(send summer (range 0 3))
+(send 1 2)
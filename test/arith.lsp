@@ -0,0 +1,19 @@
+(def {m} (- 0 9223372036854775807 1))
+(/ m -1)
+(% m -1)
+(/ m 0)
+(/ m 2)
+(def {f} (\ {x} {/ x -1}))
+(reduce + (map (\ {i} {f 6}) (range 0 40)))
+(f m)
+(+ 9223372036854775807 1)
+(- m 1)
+(- m)
+(* 4611686018427387904 2)
+(^ 2 63)
+(reduce + (range m (+ m 8)))
+(reduce * {4611686018427387904 2})
+(foldl + 1 {9223372036854775807})
+(def {g} (\ {x} {+ x 9223372036854775806}))
+(reduce max (map (\ {i} {g 0}) (range 0 40)))
+(g 2)
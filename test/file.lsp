@@ -0,0 +1,23 @@
+(def {f} "/tmp/mylisp-test-file.txt")
+(write-file f "line one\nline two\n\nlast")
+(read-file f)
+(read-lines f)
+(len (read-lines f))
+(write-file f "")
+(read-file f)
+(read-lines f)
+(write-file f {1 "two" {3}})
+(read-file f)
+(write-file f "10 -20 x30, 40\n9223372036854775807 -9223372036854775808 5")
+(collect (read-numbers f))
+(reduce + (take 3 (read-numbers f)))
+(reduce + (drop 3 (take 5 (read-numbers f))))
+(write-file f (str-join " " (collect (map (\ {i} {"7"}) (range 0 100)))))
+(reduce + (read-numbers f))
+(write-file f "99999999999999999999")
+(collect (read-numbers f))
+(read-file "/tmp/mylisp-test-missing.txt")
+(read-lines "/tmp/mylisp-test-missing.txt")
+(read-numbers "/tmp/mylisp-test-missing.txt")
+(write-file "/tmp/mylisp-test-missing-dir/x" "x")
+(read-file 1)
@@ -0,0 +1,21 @@
+(= {1 2 3} {1 2 3})
+(= {1 2 3} {1 2 4})
+(= {a {b "c"} 1} {a {b "c"} 1})
+(= {a {b "c"} 1} {a {b "d"} 1})
+(= {} {})
+(= {1 2} {1 2 3})
+(= (join {1} {2 3}) {1 2 3})
+(= (list 1 2 3) {1 2 3})
+(= "abc" "abc")
+(= 1 1)
+(= 1 {1})
+(def {x} {1 2 3})
+(def {y} {1 2 3})
+(= x y)
+(def {z} (map (\ {n} {+ n 1}) x))
+z
+x
+y
+(= (tail x) {2 3})
+(= (eval (head {{1 2}})) {1 2})
+(= x)
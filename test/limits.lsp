@@ -0,0 +1,13 @@
+(def {f} (\ {x} {f x}))
+(f 1)
+(def {g} (\ {x} {+ 1 (g x)}))
+(g 1)
+(def {h} (\ {x} {head (map h {1})}))
+(h 1)
+(def {k} (\ {x} {reduce + (map k (range 0 2))}))
+(k 1)
+(def {c} (\ {x} {collect (map c (range 0 2))}))
+(c 1)
+(def {r} (\ {x} {foldl (\ {a b} {r b}) 0 {1}}))
+(r 1)
+(join-task (spawn k 1))
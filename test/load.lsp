@@ -0,0 +1,17 @@
+(def {f} "/tmp/mylisp-test-load.lsp")
+(write-file f "(def {a} 1)\n(def {b} (+ a 1))\n(def {c} 10)\n(def {d} (+ c 1))\n")
+(load f)
+(list a b c d)
+(load f)
+(write-file f "(def {a} 5)\n(def {b} (+ a 1))\n(def {c} 10)\n(def {d} (+ c 1))\n")
+(load f)
+(list a b c d)
+(write-file f "(def {c} 20)\n(def {a} 5)\n(def {b} (+ a 1))\n(def {d} (+ c 1))\n")
+(load f)
+(list a b c d)
+(write-file f "(def {a} 5)\n(def {b} (+ a 1))\n(def {d} (+ c 1))\n(def {e} (/ 1 0))\n")
+(load f)
+(list a b d)
+(load f)
+(load "/tmp/mylisp-test-missing.lsp")
+(load 1)
@@ -0,0 +1,26 @@
+(def {m} (map-new {1 "one" "two" 2 {three} {3}}))
+(map-get m 1)
+(map-get m "two")
+(map-get m {three})
+(map-get m 4 "none")
+(map-get m 4)
+(def {m2} (map-put m 4 "four"))
+(map-get m2 4)
+(map-get m 4 "still none")
+(map-get (map-put m2 1 "uno") 1)
+(map-get m2 1)
+(def {m3} (map-del m2 "two"))
+(map-get m3 "two" "gone")
+(map-get m2 "two")
+(len (map-keys m3))
+(sort (map-keys (map-new {3 a 1 b 2 c})))
+(def {big} (foldl (\ {acc i} {map-put acc i (* i i)}) (map-new {}) {0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20}))
+(len (map-keys big))
+(map-get big 17)
+(map-get (map-del big 17) 17 "deleted")
+(map-get big 17)
+(map-new {three 3})
+(map-new {1})
+(map-new {{1 2} 3})
+(map-put m {1 2} 3)
+(map-get 1 2)
@@ -0,0 +1,31 @@
+(def {sq} (memo (\ {x} {* x x})))
+(sq 3)
+(sq 3)
+(sq 4)
+(take 3 (memo-stats sq))
+(def {pair} (memo (\ {a b} {list a b})))
+(pair {1 2} "x")
+(pair {1 2} "x")
+(pair {1 3} "x")
+(take 3 (memo-stats pair))
+(def {small} (memo (\ {x} {+ x 1}) 2 1000000))
+(small 1)
+(small 2)
+(small 3)
+(small 1)
+(take 3 (memo-stats small))
+(small 3)
+(small 2)
+(small 1)
+(take 3 (memo-stats small))
+(def {div} (memo (\ {x} {/ 1 x})))
+(div 0)
+(div 0)
+(take 3 (memo-stats div))
+(def {none} (memo (\ {x} {x}) 0 1000000))
+(none 1)
+(none 1)
+(take 3 (memo-stats none))
+(memo-stats +)
+(memo 1)
+(memo sq -1 10)
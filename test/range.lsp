@@ -0,0 +1,12 @@
+(collect (take 5 (range 9223372036854775800 9223372036854775807 5)))
+(collect (range 9223372036854775800 9223372036854775807 5))
+(collect (range -9223372036854775801 -9223372036854775808 -5))
+(collect (range 9223372036854775806 -9223372036854775808 -9223372036854775807))
+(collect (range -9223372036854775808 9223372036854775807 9223372036854775807))
+(collect (drop 1 (range 9223372036854775800 9223372036854775807 5)))
+(collect (drop 5 (range 9223372036854775800 9223372036854775807 5)))
+(collect (range 1 10 -9223372036854775808))
+(collect (range 10 1 -9223372036854775808))
+(collect (range 0 10 3))
+(collect (range 10 0 -3))
+(collect (range 5 5))
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Runs each test/*.lsp through the REPL in batch mode and compares its
+# output with the .out file beside it, passing the options in its .args
+# file if there is one. REPL defaults to ./repl.
+repl=${REPL:-./repl}
+status=0
+for t in "$(dirname "$0")"/*.lsp; do
+  args=$(cat "${t%.lsp}.args" 2>/dev/null)
+  if "$repl" $args "$t" 2>&1 | diff -u "${t%.lsp}.out" - > /dev/null; then
+    echo "ok   $t"
+  else
+    echo "FAIL $t"
+    status=1
+  fi
+done
+exit $status
@@ -0,0 +1,21 @@
+(def {f} "/tmp/mylisp-test-save.bin")
+(def {v} {1 -2 9223372036854775807 -9223372036854775808 sym "str\n\"q\"" {} {nested {deep 3}}})
+(save f v)
+(restore f)
+(= (restore f) v)
+(save f 42)
+(restore f)
+(save f "a string")
+(restore f)
+(save f (collect (range 0 1000)))
+(reduce + (restore-seq f))
+(collect (take 3 (drop 500 (restore-seq f))))
+(save f (map-new {1 "one" {k} {2}}))
+(map-get (restore f) 1)
+(map-get (restore f) {k})
+(save f (\ {x} {x}))
+(save f +)
+(write-file f "not a saved value")
+(restore f)
+(restore "/tmp/mylisp-test-missing.bin")
+(save f)
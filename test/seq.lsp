@@ -0,0 +1,24 @@
+(def {evens} (filter (\ {x} {= 0 (% x 2)}) (range 0 1000000000)))
+(collect (take 5 evens))
+(collect (take 3 (drop 10 (map (\ {x} {* x x}) (range 1 1000000000)))))
+(reduce + (range 1 101))
+(reduce + (take 100 (drop 5 (range 0 1000000000 2))))
+(reduce max (map (\ {x} {- 0 x}) (range 1 10)))
+(reduce (\ {a b} {+ (* a 10) b}) (map (\ {x} {x}) (range 1 4)))
+(collect (range 0 0))
+(reduce + (range 0 0))
+(collect (map (\ {x} {/ 10 x}) (range 2 -1 -1)))
+(collect (take 2 (map (\ {x} {/ 10 x}) (range 2 -1 -1))))
+(take 2 {1 2 3})
+(drop 2 {1 2 3})
+(take 5 {1 2})
+(drop 5 {1 2})
+(take -1 {1 2})
+(drop -1 (range 0 3))
+(reduce + {1 2 3 4})
+(reduce (\ {a b} {- a b}) {10 1 2})
+(reduce + {})
+(map (\ {x} {+ x 1}) {1 2 3})
+(filter (\ {x} {> x 1}) {1 2 3})
+(range 0 1 0)
+(collect {1 2})
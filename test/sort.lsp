@@ -0,0 +1,20 @@
+(sort {3 1 2 1 0 -5})
+(sort {"pear" "apple" "fig" "app"})
+(sort {b 2 "s" a 1})
+(sort {{1 2} {1} {0 9}})
+(sort {})
+(def {by-head} (\ {a b} {< (head a) (head b)}))
+(sort-by by-head {{2 a} {1 b} {2 c} {1 d} {0 e} {2 f}})
+(def {pairs} (collect (map (\ {i} {list (% (* i 7) 5) i}) (range 0 200))))
+(def {key} (\ {k} {filter (\ {p} {= (eval (head p)) k}) pairs}))
+(= (sort-by by-head pairs) (join (key 0) (key 1) (key 2) (key 3) (key 4)))
+(head (sort-by by-head pairs))
+(def {nums} (collect (map (\ {i} {- (% (* i 7919) 1000) 500}) (range 0 500))))
+(def {sorted} (sort nums))
+(len sorted)
+(head sorted)
+(= sorted (sort-by < nums))
+(= (reduce max nums) (eval (head (sort-by > nums))))
+(sort-by (\ {a b} {/ a 0}) {1 2 3})
+(sort-by (\ {a b} {"x"}) {1 2})
+(sort 1)
@@ -0,0 +1,29 @@
+(def {s} "hello, world")
+(str-len s)
+(str-len "")
+(substr s 7)
+(substr s 0 5)
+(substr (substr s 7) 1 3)
+(substr s 12)
+(substr s 0 0)
+(def {long} (str-join "-" {"a fairly long string" "that does not fit inline" "and is sliced"}))
+long
+(str-len long)
+(substr long 21 4)
+(str-find long "sliced")
+(str-find long "a" 1)
+(str-find long "missing")
+(str-find s "" 3)
+(str-find s "o" 100)
+(str-join ", " {})
+(str-join "" {"x" "y" "z"})
+(= (substr s 0 5) "hello")
+(= (substr long 0 1) (substr s 0 1))
+(substr s 5 -2)
+(substr s 13)
+(substr s 3 10)
+(substr s -1)
+(str-join "," {"a" 1})
+(str-len 5)
+"tab\tand \"quote\""
+(str-len "a\nb")
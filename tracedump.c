@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mylisp.h"
+
+/* Decodes a trace written by trace-dump, as indented text or, with
+   --chrome, as JSON for chrome://tracing and Perfetto */
+
+/* Result type names, in LVAL_* order */
+static const char* types[] = { "Number", "Error", "Symbol", "Function",
+  "S-Expression", "Q-Expression", "Sequence", "String", "Map", "Channel" };
+
+typedef struct {
+  uint64_t fn;
+  char* name;
+} tname;
+
+static tname* names;
+static int nnames;
+
+static const char* type_name(uint32_t t) {
+  return t < sizeof(types) / sizeof(types[0]) ? types[t] : "Unknown";
+}
+
+/* The first name bound to an address wins, so aliases keep the builtin's
+   own name */
+static const char* fn_name(uint64_t fn) {
+  if (!fn) { return "<lambda>"; }
+  for (int i = 0; i < nnames; i++) {
+    if (names[i].fn == fn) { return names[i].name; }
+  }
+  return "<unknown>";
+}
+
+static void json_str(const char* s) {
+  putchar('"');
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') { putchar('\\'); }
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+static int read_names(char* p, size_t len) {
+  size_t at = 0;
+  while (at < len) {
+    uint32_t n;
+    if (len - at < sizeof(uint64_t) + sizeof(n)) { return 0; }
+    names = realloc(names, sizeof(tname) * (nnames + 1));
+    memcpy(&names[nnames].fn, p + at, sizeof(uint64_t));
+    memcpy(&n, p + at + sizeof(uint64_t), sizeof(n));
+    at += sizeof(uint64_t) + sizeof(n);
+    if (len - at < n) { return 0; }
+    names[nnames].name = malloc(n + 1);
+    memcpy(names[nnames].name, p + at, n);
+    names[nnames].name[n] = '\0';
+    nnames++;
+    at += n;
+  }
+  return 1;
+}
+
+static void print_text(ltrace_rec* r, uint32_t n) {
+  int depth = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    double us = (r[i].ns - r[0].ns) / 1000.0;
+    if (r[i].kind == LTRACE_ENTER) {
+      printf("%12.3f %*s> %s %u\n", us, depth * 2, "",
+        fn_name(r[i].fn), r[i].n);
+      depth++;
+    } else {
+      if (depth > 0) { depth--; }
+      printf("%12.3f %*s< %s %s\n", us, depth * 2, "",
+        fn_name(r[i].fn), type_name(r[i].n));
+    }
+  }
+}
+
+static void print_chrome(ltrace_rec* r, uint32_t n) {
+  puts("{\"traceEvents\":[");
+  for (uint32_t i = 0; i < n; i++) {
+    int enter = r[i].kind == LTRACE_ENTER;
+    printf("{\"name\":");
+    json_str(fn_name(r[i].fn));
+    printf(",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":1,\"args\":{",
+      enter ? "B" : "E", r[i].ns / 1000.0);
+    if (enter) {
+      printf("\"argc\":%u}}", r[i].n);
+    } else {
+      printf("\"result\":");
+      json_str(type_name(r[i].n));
+      printf("}}");
+    }
+    puts(i + 1 < n ? "," : "");
+  }
+  puts("]}");
+}
+
+int main(int argc, char** argv) {
+  int chrome = argc == 3 && strcmp(argv[1], "--chrome") == 0;
+  if (argc != 2 && !chrome) {
+    fprintf(stderr, "usage: tracedump [--chrome] file\n");
+    return 2;
+  }
+
+  FILE* f = fopen(argv[argc-1], "rb");
+  if (!f) {
+    fprintf(stderr, "Could not open file '%s'\n", argv[argc-1]);
+    return 1;
+  }
+  ltrace_hdr h;
+  char* blob = NULL;
+  ltrace_rec* recs = NULL;
+  int ok = fread(&h, sizeof(h), 1, f) == 1
+    && memcmp(h.magic, LTRACE_MAGIC, sizeof(h.magic)) == 0;
+  if (ok) {
+    blob = malloc(h.names + 1);
+    recs = malloc(sizeof(ltrace_rec) * (h.count + 1));
+    ok = fread(blob, 1, h.names, f) == h.names
+      && read_names(blob, h.names)
+      && fread(recs, sizeof(ltrace_rec), h.count, f) == h.count;
+  }
+  fclose(f);
+  if (!ok) {
+    fprintf(stderr, "'%s' is not a complete trace\n", argv[argc-1]);
+    return 1;
+  }
+
+  if (chrome) {
+    print_chrome(recs, h.count);
+  } else {
+    if (h.total > h.count) {
+      printf("(%llu earlier events overwritten)\n",
+        (unsigned long long)(h.total - h.count));
+    }
+    print_text(recs, h.count);
+  }
+
+  for (int i = 0; i < nnames; i++) { free(names[i].name); }
+  free(names);
+  free(blob);
+  free(recs);
+  return 0;
+}